@@ -0,0 +1,56 @@
+/**
+ * Insert and update throughput for documents of 1KB to 1MB.
+ *
+ * Documents from 4KB up are copied with non-temporal stores
+ * (NT_COPY_THRESHOLD in src/pmse_map.h), smaller ones through cache.
+ * Run against mongod started with --storageEngine=pmse:
+ *
+ *     mongo --eval "var benchSeconds = 10" benchmarks/document_size.js
+ */
+(function() {
+    "use strict";
+
+    var seconds = typeof benchSeconds === "undefined" ? 10 : benchSeconds;
+    var threads = typeof benchThreads === "undefined" ? 4 : benchThreads;
+    var sizes = [1024, 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024];
+    /* Documents updated in place, inserted before update run */
+    var updatedDocs = 1000;
+    var coll = db.getSiblingDB("pmse_bench").document_size;
+
+    print("size\tinserts/s\tMB/s\tupdates/s\tMB/s");
+    sizes.forEach(function(size) {
+        var payload = new Array(size + 1).join("x");
+        var mb = size / (1024 * 1024);
+
+        coll.drop();
+        var inserts = benchRun({
+            host: db.getMongo().host,
+            parallel: threads,
+            seconds: seconds,
+            ops: [{op: "insert", ns: coll.getFullName(), doc: {payload: payload}}]
+        });
+
+        coll.drop();
+        var bulk = coll.initializeUnorderedBulkOp();
+        for (var i = 0; i < updatedDocs; i++) {
+            bulk.insert({_id: i, payload: payload});
+        }
+        assert.writeOK(bulk.execute());
+        var updates = benchRun({
+            host: db.getMongo().host,
+            parallel: threads,
+            seconds: seconds,
+            ops: [{
+                op: "update",
+                ns: coll.getFullName(),
+                query: {_id: {"#RAND_INT": [0, updatedDocs]}},
+                update: {$set: {payload: payload}}
+            }]
+        });
+
+        print(size + "\t" + Math.round(inserts.insert) + "\t" +
+              (inserts.insert * mb).toFixed(1) + "\t" + Math.round(updates.update) + "\t" +
+              (updates.update * mb).toFixed(1));
+    });
+    coll.drop();
+}());
@@ -0,0 +1,45 @@
+/**
+ * Insert and seek throughput of one index with growing number of threads.
+ *
+ * Keys are random, so inserts spread over leaves; seeks are point lookups
+ * through the index. Run against mongod started with --storageEngine=pmse:
+ *
+ *     mongo --eval "var benchSeconds = 10" benchmarks/index_threads.js
+ */
+(function() {
+    "use strict";
+
+    var seconds = typeof benchSeconds === "undefined" ? 10 : benchSeconds;
+    var threadCounts = [1, 2, 4, 8, 16];
+    var keyRange = 1000000;
+    var coll = db.getSiblingDB("pmse_bench").index_threads;
+
+    print("threads\tinserts/s\tseeks/s");
+    threadCounts.forEach(function(threads) {
+        coll.drop();
+        assert.commandWorked(coll.createIndex({k: 1}));
+
+        var inserts = benchRun({
+            host: db.getMongo().host,
+            parallel: threads,
+            seconds: seconds,
+            ops: [{
+                op: "insert",
+                ns: coll.getFullName(),
+                doc: {k: {"#RAND_INT": [0, keyRange]}}
+            }]
+        });
+        var seeks = benchRun({
+            host: db.getMongo().host,
+            parallel: threads,
+            seconds: seconds,
+            ops: [{
+                op: "findOne",
+                ns: coll.getFullName(),
+                query: {k: {"#RAND_INT": [0, keyRange]}}
+            }]
+        });
+        print(threads + "\t" + Math.round(inserts.insert) + "\t" + Math.round(seeks.findOne));
+    });
+    coll.drop();
+}());
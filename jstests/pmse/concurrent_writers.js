@@ -0,0 +1,86 @@
+/**
+ * Concurrent writers on one document and on keys of one index leaf.
+ *
+ * Updates of one RecordId conflict with each other, every $inc must be
+ * applied exactly once after write conflicts are retried. Inserts and
+ * removes of equal keys go to the same leaf and split it, index must
+ * end up with every remaining entry once.
+ *
+ * Run with:
+ *     python buildscripts/resmoke.py --storageEngine=pmse \
+ *         src/mongo/db/modules/pmse/jstests/pmse/concurrent_writers.js
+ */
+(function() {
+    "use strict";
+
+    var threads = 8;
+    var ops = 500;
+    var testDB = db.getSiblingDB("pmse_concurrent_writers");
+    var coll = testDB.writers;
+
+    function runParallel(body) {
+        var joins = [];
+        for (var t = 0; t < threads; t++) {
+            var code = "var t = " + t + "; var ops = " + ops + ";" +
+                "var coll = db.getSiblingDB('" + testDB.getName() + "').writers;" +
+                "(" + body.toString() + ")();";
+            joins.push(startParallelShell(code));
+        }
+        joins.forEach(function(join) {
+            join();
+        });
+    }
+
+    function assertValid() {
+        var res = coll.validate({full: true});
+        assert.commandWorked(res);
+        assert(res.valid, tojson(res));
+    }
+
+    /* Same RecordId */
+    coll.drop();
+    assert.writeOK(coll.insert({_id: "counter", n: 0}));
+    runParallel(function() {
+        for (var i = 0; i < ops; i++) {
+            assert.writeOK(coll.update({_id: "counter"}, {$inc: {n: 1}}));
+        }
+    });
+    assert.eq(threads * ops, coll.findOne({_id: "counter"}).n);
+    assertValid();
+
+    /* Same leaf: equal keys, half of them removed while others are inserted */
+    coll.drop();
+    assert.commandWorked(coll.createIndex({k: 1}));
+    runParallel(function() {
+        for (var i = 0; i < ops; i++) {
+            assert.writeOK(coll.insert({_id: t * ops + i, k: 1}));
+            if (i % 2 == 1) {
+                assert.writeOK(coll.remove({_id: t * ops + i - 1}));
+            }
+        }
+    });
+    var expected = threads * ops / 2;
+    assert.eq(expected, coll.find({k: 1}).hint({k: 1}).itcount());
+    assert.eq(expected, coll.find().hint({_id: 1}).itcount());
+    coll.find({k: 1}).hint({k: 1}).forEach(function(doc) {
+        assert.eq(1, doc._id % 2, tojson(doc));
+    });
+    assertValid();
+
+    /* Same leaf of unique index: each key is inserted by every thread, one wins */
+    coll.drop();
+    assert.commandWorked(coll.createIndex({k: 1}, {unique: true}));
+    runParallel(function() {
+        for (var i = 0; i < ops; i++) {
+            var res = coll.insert({k: i});
+            if (res.hasWriteError()) {
+                assert.eq(ErrorCodes.DuplicateKey, res.getWriteError().code, tojson(res));
+            }
+        }
+    });
+    assert.eq(ops, coll.find().hint({k: 1}).itcount());
+    assert.eq(ops, coll.count());
+    assertValid();
+
+    testDB.dropDatabase();
+}());
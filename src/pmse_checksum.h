@@ -0,0 +1,91 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_CHECKSUM_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_CHECKSUM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "pmse_list_int_ptr.h"
+
+namespace mongo {
+
+struct PmseChecksumStats {
+    std::atomic<uint64_t> readFailures{0};
+    std::atomic<uint64_t> scrubbedRecords{0};
+    std::atomic<uint64_t> scrubbedBytes{0};
+    std::atomic<uint64_t> scrubFailures{0};
+    std::atomic<uint64_t> scrubPasses{0};
+};
+
+extern PmseChecksumStats pmseChecksumStats;
+
+/*
+ * CRC32C (Castagnoli), uses SSE4.2 crc32 instruction when CPU supports it.
+ */
+uint32_t crc32c(const void* data, size_t len);
+
+/*
+ * Fill checksum of record from source of its data, so data written
+ * with non-temporal stores isn't read back.
+ * Must be called before record is persisted.
+ */
+inline void setChecksum(InitData* obj, const void* src, bool enabled) {
+    if (enabled) {
+        obj->checksum = crc32c(src, obj->size);
+        obj->flags = INIT_DATA_CHECKSUM;
+    } else {
+        obj->checksum = 0;
+        obj->flags = 0;
+    }
+}
+
+/*
+ * Fill checksum of record with already copied data.
+ */
+inline void setChecksum(InitData* obj, bool enabled) {
+    setChecksum(obj, obj->data, enabled);
+}
+
+/*
+ * Records written without checksum are always valid.
+ */
+inline bool checksumMatches(const InitData* obj) {
+    if (!(obj->flags & INIT_DATA_CHECKSUM))
+        return true;
+    return crc32c(obj->data, obj->size) == obj->checksum;
+}
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_CHECKSUM_H_ */
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mongo/platform/basic.h"
+
+#include "pmse_dram_index.h"
+
+namespace mongo {
+
+void PmseDramIndex::reserve(uint64_t count) {
+    for (auto &stripe : _stripes) {
+        stdx::lock_guard<stdx::mutex> lock(stripe.lock);
+        stripe.map.reserve(count / DRAM_INDEX_STRIPES + 1);
+    }
+}
+
+void PmseDramIndex::insert(uint64_t id, PMEMoid oid) {
+    auto &stripe = stripeFor(id);
+    stdx::lock_guard<stdx::mutex> lock(stripe.lock);
+    stripe.map[id] = oid;
+}
+
+void PmseDramIndex::remove(uint64_t id) {
+    auto &stripe = stripeFor(id);
+    stdx::lock_guard<stdx::mutex> lock(stripe.lock);
+    stripe.map.erase(id);
+}
+
+bool PmseDramIndex::find(uint64_t id, PMEMoid &oid) const {
+    auto &stripe = stripeFor(id);
+    stdx::lock_guard<stdx::mutex> lock(stripe.lock);
+    auto it = stripe.map.find(id);
+    if (it == stripe.map.end())
+        return false;
+    oid = it->second;
+    return true;
+}
+
+bool PmseDramIndex::contains(uint64_t id) const {
+    auto &stripe = stripeFor(id);
+    stdx::lock_guard<stdx::mutex> lock(stripe.lock);
+    return stripe.map.count(id) != 0;
+}
+
+void PmseDramIndex::clear() {
+    for (auto &stripe : _stripes) {
+        stdx::lock_guard<stdx::mutex> lock(stripe.lock);
+        stripe.map.clear();
+    }
+}
+
+uint64_t PmseDramIndex::size() const {
+    uint64_t total = 0;
+    for (auto &stripe : _stripes) {
+        stdx::lock_guard<stdx::mutex> lock(stripe.lock);
+        total += stripe.map.size();
+    }
+    return total;
+}
+
+}
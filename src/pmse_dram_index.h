@@ -0,0 +1,80 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_DRAM_INDEX_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_DRAM_INDEX_H_
+
+#include <unordered_map>
+
+#include <libpmemobj.h>
+
+#include "mongo/stdx/mutex.h"
+
+namespace mongo {
+
+const uint64_t DRAM_INDEX_STRIPES = 64;
+
+/*
+ * Volatile RecordId -> PMEMoid mapping used in hybrid mode.
+ * Nothing is persisted, content is rebuilt from persistent lists on open.
+ */
+class PmseDramIndex {
+public:
+    PmseDramIndex() = default;
+
+    void reserve(uint64_t count);
+    void insert(uint64_t id, PMEMoid oid);
+    void remove(uint64_t id);
+    bool find(uint64_t id, PMEMoid &oid) const;
+    bool contains(uint64_t id) const;
+    void clear();
+    uint64_t size() const;
+
+private:
+    struct Stripe {
+        mutable stdx::mutex lock;
+        std::unordered_map<uint64_t, PMEMoid> map;
+    };
+
+    Stripe& stripeFor(uint64_t id) {
+        return _stripes[id % DRAM_INDEX_STRIPES];
+    }
+
+    const Stripe& stripeFor(uint64_t id) const {
+        return _stripes[id % DRAM_INDEX_STRIPES];
+    }
+
+    Stripe _stripes[DRAM_INDEX_STRIPES];
+};
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_DRAM_INDEX_H_ */
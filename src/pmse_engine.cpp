@@ -44,6 +44,7 @@
 #include "pmse_sorted_data_interface.h"
 #include "pmse_record_store.h"
 #include "pmse_engine.h"
+#include "pmse_numa.h"
 
 #include <cstdlib>
 #include <iostream>
@@ -54,7 +55,8 @@ Status PmseEngine::createRecordStore(OperationContext* opCtx, StringData ns, Str
                                      const CollectionOptions& options) {
     auto status = Status::OK();
     try {
-        auto record_store = stdx::make_unique<PmseRecordStore>(ns, options, _DBPATH);
+        auto record_store = stdx::make_unique<PmseRecordStore>(ns, options, _DBPATH,
+                                                               _dbDir(ident));
         identList->insertKV(ident.toString().c_str(), ns.toString().c_str());
 
     } catch(std::exception &e) {
@@ -67,7 +69,7 @@ std::unique_ptr<RecordStore> PmseEngine::getRecordStore(OperationContext* opCtx,
                                                         StringData ns,
                                                         StringData ident,
                                                         const CollectionOptions& options) {
-    return stdx::make_unique<PmseRecordStore>(ns, options, _DBPATH);
+    return stdx::make_unique<PmseRecordStore>(ns, options, _DBPATH, _dbDir(ident));
 }
 
 Status PmseEngine::createSortedDataInterface(OperationContext* opCtx,
@@ -84,14 +86,27 @@ SortedDataInterface* PmseEngine::getSortedDataInterface(OperationContext* opCtx,
 
 Status PmseEngine::dropIdent(OperationContext* opCtx, StringData ident) {
     bool status;
-    boost::filesystem::path path(_DBPATH);
     const char* ns = identList->find(ident.toString().c_str(), status);
     identList->deleteKV(ident.toString().c_str());
-    if(!std::string(ns).empty()) {
-        boost::filesystem::remove_all(path.string()+ns);
+    std::string dbDir = _dbDir(ident);
+    /* Pool may live in dbpath or in directory of any NUMA node */
+    for (const std::string& dir : pmsePoolDirs(_DBPATH)) {
+        if(!std::string(ns).empty()) {
+            boost::filesystem::remove_all(dir+dbDir+ns);
+        }
+        boost::filesystem::remove_all(dir+dbDir+ns+"_mapper");
+        boost::filesystem::remove_all(dir+ident.toString());
+    }
+    /* Stripes other than first one, count isn't known after pool is gone */
+    for (uint64_t stripe = 1; ; stripe++) {
+        uint64_t removed = 0;
+        for (const std::string& dir : pmsePoolDirs(_DBPATH)) {
+            removed += boost::filesystem::remove_all(
+                            dir + dbDir + ns + "_mapper." + std::to_string(stripe));
+        }
+        if (!removed)
+            break;
     }
-    boost::filesystem::remove_all(path.string()+ns+"_mapper");
-    boost::filesystem::remove_all(path.string()+ident.toString());
     return Status::OK();
 }
 
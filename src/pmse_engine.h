@@ -41,8 +41,11 @@
 #include <unordered_set>
 
 #include "mongo/db/storage/kv/kv_engine.h"
-#include "mongo/db/storage/recovery_unit_noop.h"
+#include "pmse_global_options.h"
 #include "pmse_list.h"
+#include "pmse_recovery_unit.h"
+#include "pmse_scrubber.h"
+#include "pmse_snapshot.h"
 
 #include <libpmemobj.h>
 #include <libpmemobj++/p.hpp>
@@ -84,14 +87,18 @@ public:
             std::cout << "Error while creating PMStore engine:" << e.what() << std::endl;
         };
         identList->setPool(pop);
+        PmseSnapshotManager::get().init(identList->nextGeneration());
+        if (pmseGlobalOptions.scrubRateMB > 0) {
+            PmseScrubber::get().start(pmseGlobalOptions.scrubRateMB * 1024ULL * 1024ULL);
+        }
     }
     virtual ~PmseEngine() {
+        PmseScrubber::get().shutdown();
         pop.close();
     }
 
     virtual RecoveryUnit* newRecoveryUnit() {
-        // TODO: Implement RecoveryUnit
-        return new RecoveryUnitNoop();
+        return new PmseRecoveryUnit();
     }
 
     virtual Status createRecordStore(OperationContext* opCtx,
@@ -119,7 +126,7 @@ public:
     }
 
     virtual bool supportsDirectoryPerDB() const {
-        return false;
+        return true;
     }
 
     virtual bool isDurable() const {
@@ -149,11 +156,24 @@ public:
         return identList->getKeys();
     }
 
-    virtual void cleanShutdown() {};
+    virtual void cleanShutdown() {
+        PmseScrubber::get().shutdown();
+    };
 
     void setJournalListener(JournalListener* jl) final {}
 
 private:
+    /*
+     * With directoryPerDB idents are prefixed with database name,
+     * pools of ident are placed in subdirectory of that name.
+     */
+    static std::string _dbDir(StringData ident) {
+        auto pos = ident.rfind('/');
+        if (pos == std::string::npos)
+            return "";
+        return ident.substr(0, pos + 1).toString();
+    }
+
     std::shared_ptr<void> _catalogInfo;
     const std::string _DBPATH;
     PMEMobjpool *pm_pool = NULL;
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mongo/platform/basic.h"
+
+#include "pmse_epoch.h"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+namespace mongo {
+
+PmseEpochManager& PmseEpochManager::get() {
+    static PmseEpochManager manager;
+    return manager;
+}
+
+uint64_t PmseEpochManager::enter() {
+    for (;;) {
+        uint64_t epoch = _epoch.load();
+        _active[epoch % 3]++;
+        if (_epoch.load() == epoch)
+            return epoch;
+        _active[epoch % 3]--;
+    }
+}
+
+void PmseEpochManager::leave(uint64_t epoch) {
+    _active[epoch % 3]--;
+}
+
+uint64_t PmseEpochManager::tryAdvance() {
+    uint64_t epoch = _epoch.load();
+    if (_active[(epoch - 1) % 3].load() == 0)
+        _epoch.compare_exchange_strong(epoch, epoch + 1);
+    return _epoch.load();
+}
+
+void PmseLimbo::retire(PMEMoid oid) {
+    if (OID_IS_NULL(oid))
+        return;
+    transaction::exec_tx(pool_by_vptr(this), [&] {
+        auto entry = make_persistent<PmseLimboEntry>();
+        entry->oid = oid;
+        entry->epoch = PmseEpochManager::get().current();
+        entry->next = nullptr;
+        if (_tail != nullptr)
+            _tail->next = entry;
+        else
+            _head = entry;
+        _tail = entry;
+    }, _lock);
+}
+
+uint64_t PmseLimbo::release(pool_base pop, uint64_t current, uint64_t maxObjects) {
+    uint64_t freed = 0;
+    if (empty())
+        return 0;
+    transaction::exec_tx(pop, [&] {
+        while (_head != nullptr && freed < maxObjects
+               && PmseEpochManager::reclaimable(_head->epoch, current)) {
+            auto entry = _head;
+            _head = entry->next;
+            pmemobj_tx_free(entry->oid);
+            delete_persistent<PmseLimboEntry>(entry);
+            freed++;
+        }
+        if (_head == nullptr)
+            _tail = nullptr;
+    }, _lock);
+    return freed;
+}
+
+}
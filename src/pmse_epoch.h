@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_EPOCH_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_EPOCH_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include <libpmemobj.h>
+#include <libpmemobj++/mutex.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+using namespace nvml::obj;
+
+namespace mongo {
+
+const uint64_t RELEASE_BATCH_SIZE = 256;
+
+/*
+ * Epoch based reclamation. Operations reading persistent structures
+ * without locks stay inside epoch, objects unlinked in epoch e are freed
+ * when epoch reaches e + 2: by then every operation which could see them
+ * has left. Readers are counted per epoch, only current and previous
+ * epoch can have readers.
+ */
+class PmseEpochManager {
+public:
+    static PmseEpochManager& get();
+
+    uint64_t enter();
+    void leave(uint64_t epoch);
+
+    uint64_t current() const {
+        return _epoch.load();
+    }
+
+    /* Moves to next epoch when previous one has no readers */
+    uint64_t tryAdvance();
+
+    static bool reclaimable(uint64_t retired, uint64_t current) {
+        return retired + 2 <= current;
+    }
+
+private:
+    PmseEpochManager() = default;
+
+    std::atomic<uint64_t> _epoch{2};
+    std::atomic<uint64_t> _active[3] = {};
+};
+
+struct PmseLimboEntry {
+    PMEMoid oid;
+    p<uint64_t> epoch;
+    persistent_ptr<PmseLimboEntry> next;
+};
+
+/*
+ * Persistent queue of unlinked objects waiting for reclamation, kept
+ * in the pool which owns them. Object is queued in the transaction
+ * which unlinks it, so it isn't leaked on crash. Lock is held until
+ * outermost transaction ends, which keeps queue in epoch order.
+ */
+class PmseLimbo {
+public:
+    /* Must be called inside transaction on pool of limbo */
+    void retire(PMEMoid oid);
+
+    /* Frees at most maxObjects reclaimable objects, returns number freed */
+    uint64_t release(pool_base pop, uint64_t current, uint64_t maxObjects);
+
+    bool empty() const {
+        return _head == nullptr;
+    }
+
+private:
+    nvml::obj::mutex _lock;
+    persistent_ptr<PmseLimboEntry> _head;
+    persistent_ptr<PmseLimboEntry> _tail;
+};
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_EPOCH_H_ */
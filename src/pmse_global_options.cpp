@@ -0,0 +1,164 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define MONGO_LOG_DEFAULT_COMPONENT ::mongo::logger::LogComponent::kStorage
+
+#include "mongo/platform/basic.h"
+#include "mongo/util/log.h"
+#include "mongo/util/options_parser/constraints.h"
+
+#include "pmse_global_options.h"
+
+namespace mongo {
+
+PmseGlobalOptions pmseGlobalOptions;
+
+namespace {
+/*
+ * Splits comma separated list of directories, every one ends with '/'.
+ */
+std::vector<std::string> parsePaths(const std::string& paths) {
+    std::vector<std::string> dirs;
+    std::string::size_type begin = 0;
+    while (begin <= paths.size()) {
+        auto end = paths.find(',', begin);
+        if (end == std::string::npos)
+            end = paths.size();
+        std::string path = paths.substr(begin, end - begin);
+        if (!path.empty()) {
+            if (path.back() != '/')
+                path += '/';
+            dirs.push_back(path);
+        }
+        begin = end + 1;
+    }
+    return dirs;
+}
+}
+
+Status PmseGlobalOptions::add(moe::OptionSection* options) {
+    moe::OptionSection pmseOptions("PMSE options");
+
+    pmseOptions.addOptionChaining("storage.pmse.hybridIndex",
+                                  "pmseHybridIndex", moe::Switch,
+                                  "keep record locations in a DRAM index rebuilt at startup");
+    pmseOptions.addOptionChaining("storage.pmse.workerThreads",
+                                  "pmseWorkerThreads", moe::Int,
+                                  "number of threads for parallel maintenance work, 0 = all cores")
+        .validRange(0, 1024);
+    pmseOptions.addOptionChaining("storage.pmse.recordChecksums",
+                                  "pmseRecordChecksums", moe::Switch,
+                                  "store and verify CRC32C checksum of every record");
+    pmseOptions.addOptionChaining("storage.pmse.scrubRateMB",
+                                  "pmseScrubRateMB", moe::Int,
+                                  "background checksum scrubber rate in MB/s, 0 = disabled")
+        .validRange(0, 100000);
+    pmseOptions.addOptionChaining("storage.pmse.touchOnStartup",
+                                  "pmseTouchOnStartup", moe::String,
+                                  "prefault pools when opened: none, metadata or full")
+        .format("(:?none)|(:?metadata)|(:?full)", "(none/metadata/full)");
+    pmseOptions.addOptionChaining("storage.pmse.numaPaths",
+                                  "pmseNumaPaths", moe::String,
+                                  "comma separated pool directories, one per NUMA node");
+    pmseOptions.addOptionChaining("storage.pmse.stripePaths",
+                                  "pmseStripePaths", moe::String,
+                                  "comma separated directories new collections are striped over");
+    pmseOptions.addOptionChaining("storage.pmse.unsortedLeaves",
+                                  "pmseUnsortedLeaves", moe::Switch,
+                                  "create indexes with unsorted leaves, keys are appended to free slots");
+    pmseOptions.addOptionChaining("storage.pmse.volatileInnerNodes",
+                                  "pmseVolatileInnerNodes", moe::Switch,
+                                  "create indexes with inner nodes in DRAM, rebuilt from leaves on open");
+    pmseOptions.addOptionChaining("storage.pmse.indexLatchWords",
+                                  "pmseIndexLatchWords", moe::Int,
+                                  "node version words per open index, rounded up to power of two")
+        .validRange(64, 1 << 24);
+
+    return options->addSection(pmseOptions);
+}
+
+Status PmseGlobalOptions::store(const moe::Environment& params,
+                                const std::vector<std::string>& args) {
+    if (params.count("storage.pmse.hybridIndex")) {
+        pmseGlobalOptions.hybridIndex = params["storage.pmse.hybridIndex"].as<bool>();
+        log() << "PMSE hybrid index: " << pmseGlobalOptions.hybridIndex;
+    }
+    if (params.count("storage.pmse.workerThreads")) {
+        pmseGlobalOptions.workerThreads = params["storage.pmse.workerThreads"].as<int>();
+        log() << "PMSE worker threads: " << pmseGlobalOptions.workerThreads;
+    }
+    if (params.count("storage.pmse.recordChecksums")) {
+        pmseGlobalOptions.recordChecksums = params["storage.pmse.recordChecksums"].as<bool>();
+        log() << "PMSE record checksums: " << pmseGlobalOptions.recordChecksums;
+    }
+    if (params.count("storage.pmse.scrubRateMB")) {
+        pmseGlobalOptions.scrubRateMB = params["storage.pmse.scrubRateMB"].as<int>();
+        log() << "PMSE scrubber rate: " << pmseGlobalOptions.scrubRateMB << " MB/s";
+    }
+    if (params.count("storage.pmse.touchOnStartup")) {
+        std::string mode = params["storage.pmse.touchOnStartup"].as<std::string>();
+        if (mode == "full") {
+            pmseGlobalOptions.touchOnStartup = kTouchFull;
+        } else if (mode == "metadata") {
+            pmseGlobalOptions.touchOnStartup = kTouchMetadata;
+        } else {
+            pmseGlobalOptions.touchOnStartup = kTouchNone;
+        }
+        log() << "PMSE touch on startup: " << mode;
+    }
+    if (params.count("storage.pmse.numaPaths")) {
+        std::string paths = params["storage.pmse.numaPaths"].as<std::string>();
+        pmseGlobalOptions.numaPaths = parsePaths(paths);
+        log() << "PMSE NUMA paths: " << paths;
+    }
+    if (params.count("storage.pmse.stripePaths")) {
+        std::string paths = params["storage.pmse.stripePaths"].as<std::string>();
+        pmseGlobalOptions.stripePaths = parsePaths(paths);
+        log() << "PMSE stripe paths: " << paths;
+    }
+    if (params.count("storage.pmse.unsortedLeaves")) {
+        pmseGlobalOptions.unsortedLeaves = params["storage.pmse.unsortedLeaves"].as<bool>();
+        log() << "PMSE unsorted leaves: " << pmseGlobalOptions.unsortedLeaves;
+    }
+    if (params.count("storage.pmse.volatileInnerNodes")) {
+        pmseGlobalOptions.volatileInnerNodes =
+                        params["storage.pmse.volatileInnerNodes"].as<bool>();
+        log() << "PMSE volatile inner nodes: " << pmseGlobalOptions.volatileInnerNodes;
+    }
+    if (params.count("storage.pmse.indexLatchWords")) {
+        pmseGlobalOptions.indexLatchWords = params["storage.pmse.indexLatchWords"].as<int>();
+        log() << "PMSE index latch words: " << pmseGlobalOptions.indexLatchWords;
+    }
+    return Status::OK();
+}
+
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_GLOBAL_OPTIONS_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_GLOBAL_OPTIONS_H_
+
+#include <string>
+#include <vector>
+
+#include "mongo/util/options_parser/environment.h"
+#include "mongo/util/options_parser/option_section.h"
+
+namespace mongo {
+
+namespace moe = mongo::optionenvironment;
+
+enum PmseTouchMode {
+    kTouchNone = 0,
+    kTouchMetadata = 1,     //bucket arrays and tree inner nodes
+    kTouchFull = 2          //whole pool mapping
+};
+
+class PmseGlobalOptions {
+public:
+    PmseGlobalOptions() : hybridIndex(false), workerThreads(0),
+                          recordChecksums(false), scrubRateMB(0),
+                          touchOnStartup(kTouchNone), unsortedLeaves(false),
+                          volatileInnerNodes(false), indexLatchWords(4096) {}
+
+    Status add(moe::OptionSection* options);
+    Status store(const moe::Environment& params,
+                 const std::vector<std::string>& args);
+
+    /*
+     * Keep RecordId -> record mapping of collections in DRAM,
+     * rebuilt from the persistent bucket lists when collection is opened.
+     */
+    bool hybridIndex;
+    /*
+     * Number of threads used by parallel maintenance work (index rebuild etc.).
+     * 0 means number of hardware threads.
+     */
+    int workerThreads;
+    /*
+     * Store CRC32C of every written record and verify it on read.
+     */
+    bool recordChecksums;
+    /*
+     * Rate limit of background scrubber in MB/s, 0 disables scrubber.
+     */
+    int scrubRateMB;
+    /*
+     * Prefault pools of collections and indexes when they are opened.
+     */
+    PmseTouchMode touchOnStartup;
+    /*
+     * Directory on DAX namespace of each NUMA node, indexed by node.
+     * Empty means all pools are placed in dbpath.
+     */
+    std::vector<std::string> numaPaths;
+    /*
+     * Not capped collections created with more than one directory here
+     * are striped over pools in all of them.
+     */
+    std::vector<std::string> stripePaths;
+    /*
+     * New indexes append keys to free leaf slots and keep their order
+     * in a small slot array, instead of shifting slots on insert.
+     */
+    bool unsortedLeaves;
+    /*
+     * New indexes keep only leaves in pool, inner nodes are in DRAM and
+     * are rebuilt from leaf chain when index is opened.
+     */
+    bool volatileInnerNodes;
+    /*
+     * Version words in latch table of each open index. Tree nodes are
+     * hashed to them, nodes sharing word are latched together.
+     */
+    int indexLatchWords;
+};
+
+extern PmseGlobalOptions pmseGlobalOptions;
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_GLOBAL_OPTIONS_H_ */
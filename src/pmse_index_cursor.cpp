@@ -32,699 +32,310 @@
 
 #include "pmse_index_cursor.h"
 
+#include <algorithm>
+#include <utility>
+
 #define MONGO_LOG_DEFAULT_COMPONENT ::mongo::logger::LogComponent::kStorage
 
 namespace mongo {
 
-PmseCursor::PmseCursor(OperationContext* txn, bool isForward,
-                       persistent_ptr<PmseTree> tree, const BSONObj& ordering,
-                       const bool unique) :
+template <uint64_t ORDER>
+PmseCursor<ORDER>::PmseCursor(OperationContext* txn, bool isForward,
+                              PmseTreeImpl<ORDER>* tree) :
                                 _forward(isForward),
-                                _ordering(ordering),
-                                _first(tree->first),
-                                _last(tree->last),
-                                _unique(unique),
-                                _tree(tree),
-                                _inf(0) {
-    cursorType = EOO;
-
-    _endPosition = 0;
-
-    BSONObjBuilder minBob;
-    minBob.append("", -std::numeric_limits<double>::infinity());
-    min = minBob.obj();
-
-    BSONObjBuilder maxBob;
-    maxBob.append("", std::numeric_limits<double>::infinity());
-    max = maxBob.obj();
+                                _tree(tree) {
+    reattachToOperationContext(txn);
 }
 
 /*
- * Find leaf which may contain key that we are looking for
+ * Bound is encoded between keys, so no entry is equal to it. Forward
+ * cursor ends after key if inclusive and before it otherwise, backward
+ * cursor the other way round.
  */
-persistent_ptr<PmseTreeNode> PmseCursor::find_leaf(
-                persistent_ptr<PmseTreeNode> node, const BSONObj& key,
-                const BSONObj& _ordering) {
-    uint64_t i;
-    int64_t cmp;
-    bool wasEqual = false;
-    persistent_ptr<PmseTreeNode> current = node;
-
-    if (current == nullptr)
-        return current;
-    while (!current->is_leaf) {
-        i = 0;
-        while (i < current->num_keys) {
-            cmp = key.woCompare(current->keys[i].getBSON(), _ordering, false);
-            if (cmp > 0) {
-                i++;
-            } else {
-                if (cmp == 0) {
-                    /*
-                     * Tricky: support for un-unique keys
-                     * If first and second node are equal to looked key , it means that we should enter between them
-                     */
-                    if (wasEqual) {
-                        break;
-                    } else {
-                        wasEqual = true;
-                        i++;
-                    }
-
-                } else {
-                    break;
-                }
-            }
-        }
-        current = current->children_array[i];
-    }
-
-    return current;
-}
-
-void PmseCursor::setEndPosition(const BSONObj& key, bool inclusive) {
-    uint64_t i;
-    int cmp;
-
-    if (!_tree->root) {
-        return;
-    }
-
-    if (inclusive) {
-        cursorType = key.firstElementType();
-    } else {
-        cursorType = EOO;
-    }
-    if (SimpleBSONObjComparator::kInstance.evaluate(key == max)) {
-
+template <uint64_t ORDER>
+void PmseCursor<ORDER>::setEndPosition(const BSONObj& key, bool inclusive) {
+    if (key.isEmpty()) {
         // This means scan to end of index.
-        _endPosition = nullptr;
+        _endPosition = boost::none;
         return;
     }
+    _endPosition = _tree->encodeKey(key, _forward == inclusive ?
+                    KeyString::kExclusiveAfter : KeyString::kExclusiveBefore);
+}
 
-    if (SimpleBSONObjComparator::kInstance.evaluate(key == min)) {
-        // This means scan to end of index.
-        _endPosition = 0;
-        return;
-    }
-
-    if (key.firstElementType() == MaxKey) {
-        _endPosition = nullptr;
-        return;
-    }
-
-    /*
-     * Find leaf node where key may exist
-     */
-    persistent_ptr<PmseTreeNode> node = find_leaf(_tree->root, key, _ordering);
-
-    if (node == nullptr) {
-        _endPosition = nullptr;
-        return;
-    }
-    /*
-     * Find place in leaf where key may exist
-     */
-
-    for (i = 0; i < node->num_keys; i++) {
-        cmp = key.woCompare(node->keys[i].getBSON(), _ordering, false);
-        if (cmp <= 0)
-            break;
-    }
-    if (!inclusive) {
-        if (_forward) {
-            if (i == node->num_keys) {
-                /*
-                 * Key is in next node. Move to next node.
-                 */
-                if (node->next) {
-                    node = node->next;
-                    _endPosition = &(node->keys[0]);
-                } else {
-                    _endPosition = nullptr;
-                }
-
-                return;
-            } else {
-                /*
-                 * Key is in this node
-                 */
-                _endPosition = &(node->keys[i]);
-                return;
-            }
-        }            //if(_forward)
-        else {
-            if (cmp == 0) { //find last element from many non-unique
-                while (key.woCompare(node->keys[i].getBSON(), _ordering, false)
-                                == 0) {
-
-                    _endPosition = &(node->keys[i]);
-                    /*
-                     * There are next keys - increment i
-                     */
-                    if (i < (node->num_keys - 1)) {
-                        i++;
-                    } else {
-                        /*
-                         * Move to next node - if it exist
-                         */
-                        if (node->next != nullptr) {
-
-                            node = node->next;
-                            i = 0;
-                        } else {
-                            _inf = MAX_END;
-                            return;
-                        }
-                    }
-
-                }
-            } else {
-                if (i == node->num_keys) {
-                    _endPosition = &(node->keys[i - 1]);
+template <uint64_t ORDER>
+boost::optional<IndexKeyEntry> PmseCursor<ORDER>::next(
+                RequestedInfo parts) {
+    if (_isEOF)
+        return boost::none;
+    if (_moved)
+        reposition();
+    else
+        _index += _forward ? 1 : -1;
+    return current(parts);
+}
 
-                    return;
-                } else {
-                    /*
-                     * Key is in this node
-                     */
-                    _endPosition = &(node->keys[i]);
-                    return;
-                }
-            }
+/*
+ * Places cursor on first entry after bound, or last one before it when
+ * moving backward. Leaf is searched at version seen on the way down.
+ */
+template <uint64_t ORDER>
+void PmseCursor<ORDER>::locate(StringData bound) {
+    PmseLatchTable& table = _tree->_latches;
+    _moved = false;
+    /* Until entry is returned, cursor is placed again at bound */
+    _lastKey = bound.toString();
+    _lastLoc = RecordId();
+    while (true) {
+        _node = _tree->findLeaf(bound, _version);
+        if (_node == nullptr) {
+            _isEOF = true;
             return;
         }
-    } else {
-
-        if (_forward) {
-
-            /*
-             * Move forward until key is not equal to the looked one
-             */
-            if (cmp == 0) {
-
-                while (key.woCompare(node->keys[i].getBSON(), _ordering, false)
-                                == 0) {
-                    /*
-                     * There are next keys - increment i
-                     */
-                    if (i < (node->num_keys - 1)) {
-                        i++;
-                    } else {
-                        /*
-                         * Move to next node - if it exist
-                         */
-                        if (node->next != nullptr) {
-
-                            node = node->next;
-                            i = 0;
-                        } else {
-                            _endPosition = nullptr;
-                            return;
-                        }
-                    }
-
-                }
-            }
-
-            if (i == node->num_keys) {
-                if (node->next) {
-                    node = node->next;
-                    _endPosition = &(node->keys[0]);
-                } else {
-                    _endPosition = nullptr;
-                }
-                return;
-            } else {
-                _endPosition = &(node->keys[i]);
-                return;
-            }
-        } //if(_forward){
-        else {
-            //move backward till first element
-            if (cmp == 0) {
-                while (key.woCompare(node->keys[i].getBSON(), _ordering, false)
-                                == 0) {
-                    /*
-                     * There are previous keys - increment i
-                     */
-                    if (i > 0) {
-                        i--;
-                    } else {
-                        /*
-                         * Move to prev node - if it exist
-                         */
-                        if (node->previous != nullptr) {
-
-                            node = node->previous;
-                            i = node->num_keys - 1;
-                        } else {
-                            _inf = MIN_END;
-                            return;
-                            //break;
-                        }
-                    }
-                }
-                _endPosition = &(node->keys[i]);
-            } else {
-                if (node->previous == nullptr) {
-                    _inf = MIN_END;
-                }
-            }
-
+        int cmp;
+        uint64_t i = _tree->leafLowerBound(_node, bound, cmp);
+        if (table.validate(_node.get(), _version)) {
+            _isEOF = false;
+            _index = _forward ? i : static_cast<int64_t>(i) - 1;
             return;
         }
     }
 }
 
-boost::optional<IndexKeyEntry> PmseCursor::next(
-                RequestedInfo parts = kKeyAndLoc) {
-    /*
-     * Advance cursor in leaves
-     */
-
-    if (!_tree->root) {
-        return boost::none;
-    }
-    if (_tree->_cursor.node == nullptr)
-        return boost::none;
-
-    if (_tree->modified) {
-        _tree->modified = false;
-        if (_tree->_cursor.index != 0) {
-            _tree->_cursor.index--;
+/*
+ * Leaf of cursor changed, so cursor is placed after last returned entry
+ * again. Its record is looked for in run of equal keys in leaf the key
+ * belongs to; if it's gone, whole run is passed.
+ */
+template <uint64_t ORDER>
+void PmseCursor<ORDER>::reposition() {
+    PmseLatchTable& table = _tree->_latches;
+    _moved = false;
+    while (true) {
+        _node = _tree->findLeaf(_lastKey, _version);
+        if (_node == nullptr) {
+            _isEOF = true;
+            return;
         }
-    }
-
-    if (_endPosition
-                    && (SimpleBSONObjComparator::kInstance.evaluate(
-                                    _tree->_cursor.node->keys[_tree->_cursor.index].getBSON()
-                                                    == _endPosition->getBSON()))) {
-        return boost::none;
-    }
-    if (correctType(
-                    _tree->_cursor.node->keys[_tree->_cursor.index].getBSON())) {
-        _returnValue.node = _tree->_cursor.node;
-        _returnValue.index = _tree->_cursor.index;
-        moveToNext();
-        return IndexKeyEntry(
-                        _returnValue.node->keys[_returnValue.index].getBSON(),
-                        _returnValue.node->values_array[_returnValue.index]);
-    }
-    return boost::none;
-}
-
-bool PmseCursor::previous() {
-    if (_previousCursor.index == 0) {
-        /*
-         * It is first element, move to prev node
-         */
-        if (_previousCursor.node->previous) {
-            _previousCursor.node = _previousCursor.node->previous;
-            _previousCursor.index = _previousCursor.node->num_keys - 1;
-            return true;
-        } else {
-            /*
-             * There are no more prev
-             */
-            return false;
+        int cmp;
+        uint64_t count = std::min<uint64_t>(_node->num_keys, ORDER);
+        uint64_t start = std::min(_tree->leafLowerBound(_node, _lastKey, cmp), count);
+        uint64_t end = start;
+        uint64_t found = count;
+        for (; end < count && _tree->compareLeafKey(_lastKey, _node, end) == 0; end++) {
+            if (_tree->leafValue(_node, end) == _lastLoc)
+                found = end;
         }
-    } else {
-        _previousCursor.index = _previousCursor.index - 1;
-        return true;
+        if (!table.validate(_node.get(), _version))
+            continue;
+        if (found < count)
+            _index = static_cast<int64_t>(found) + (_forward ? 1 : -1);
+        else
+            _index = _forward ? end : static_cast<int64_t>(start) - 1;
+        return;
     }
-
 }
 
 /*
- * Check if types of two BSONObjs are comparable
+ * Returns entry cursor is on, moving to neighbor leaf when index passed
+ * end of its leaf. Neighbor is reached through leaf of unchanged version,
+ * see PmseTreeImpl::findLeaf. Entry is copied and its leaf validated
+ * before key is decoded, cursor is placed again if leaf changed.
  */
-bool PmseCursor::correctType(BSONObj record) {
-    bool result = false;
-
-    BSONType typeRecord = record.firstElementType();
-    if (cursorType == typeRecord)
-        return true;
-
-    if (cursorType == MinKey || cursorType == MaxKey
-                    || cursorType == Undefined) {
-        return true;
-    }
-    switch (cursorType) {
-    case NumberDouble:
-    case NumberInt:
-    case NumberLong:
-    case NumberDecimal:
-        if ((typeRecord == NumberDouble) || (typeRecord == NumberInt)
-                        || (typeRecord == NumberLong)
-                        || (typeRecord == NumberDecimal))
-            result = true;
-        break;
-    case Object:
-        if (typeRecord == Object)
-            result = true;
-        break;
-    case String:
-        if (typeRecord == String)
-            result = true;
-        break;
-    case jstOID:
-        if (typeRecord == jstOID)
-            result = true;
-        break;
-    case Bool:
-        if (typeRecord == Bool)
-            result = true;
-        break;
-    case Date:
-        if (typeRecord == Date)
-            result = true;
-        break;
-    default:
-        std::cout << "not supported ";
-        std::cout << std::endl;
-    }
-    return result;
-}
-
-void PmseCursor::moveToNext() {
-    if (_forward) {
-        /*
-         * There are next keys - increment index
-         */
-        if (_tree->_cursor.index < (_tree->_cursor.node->num_keys - 1)) {
-            _tree->_cursor.index++;
-        } else {
-            /*
-             * Move to next node - if it exist
-             */
-            if (_tree->_cursor.node->next != nullptr) {
-
-                _tree->_cursor.node = _tree->_cursor.node->next;
-                _tree->_cursor.index = 0;
-            } else {
-                _tree->_cursor.node = nullptr;
+template <uint64_t ORDER>
+boost::optional<IndexKeyEntry> PmseCursor<ORDER>::current(RequestedInfo parts) {
+    PmseLatchTable& table = _tree->_latches;
+    while (!_isEOF) {
+        int64_t count = std::min<uint64_t>(_node->num_keys, ORDER);
+        if (_forward ? _index >= count : _index < 0) {
+            PmseNodePtr<ORDER> next = _forward ? _node->next : _node->previous;
+            uint64_t nextVersion = next != nullptr ? table.readBegin(next.get()) : 0;
+            if (!table.validate(_node.get(), _version)) {
+                reposition();
+                continue;
             }
-        }
-    } else {
-        /*
-         * There are next keys - increment index
-         */
-        if (_tree->_cursor.index > 0) {
-            _tree->_cursor.index--;
-        } else {
-            /*
-             * Move to prev node - if it exist
-             */
-            if (_tree->_cursor.node->previous != nullptr) {
-
-                _tree->_cursor.node = _tree->_cursor.node->previous;
-                _tree->_cursor.index = _tree->_cursor.node->num_keys - 1;
-            } else {
-                _tree->_cursor.node = nullptr;
+            if (next == nullptr) {
+                _isEOF = true;
+                break;
             }
+            _node = next;
+            _version = nextVersion;
+            _index = _forward ? 0 : static_cast<int64_t>(std::min<uint64_t>(next->num_keys, ORDER)) - 1;
+            continue;
         }
-    }
-}
-
-boost::optional<IndexKeyEntry> PmseCursor::seek(
-                const BSONObj& key, bool inclusive, RequestedInfo parts =
-                                kKeyAndLoc) {
-    uint64_t i = 0;
-    int cmp;
-
-    _returnValue = {};
-
-    if (!_tree->root) {
-        return boost::none;
-    }
-
-    if (cursorType == EOO) {
-        cursorType = key.firstElementType();
-    }
-
-    persistent_ptr<PmseTreeNode> node;
-
-    if (SimpleBSONObjComparator::kInstance.evaluate(key == min)) {
-        _tree->_cursor.node = _first;
-        _tree->_cursor.index = 0;
-        if (_endPosition
-                        && SimpleBSONObjComparator::kInstance.evaluate(
-                                        _tree->_cursor.node->keys[_tree->_cursor.index].getBSON()
-                                                        == _endPosition->getBSON()))
-            return boost::none;
-        _returnValue.node = _tree->_cursor.node;
-        _returnValue.index = _tree->_cursor.index;
-
-        moveToNext();
-        return IndexKeyEntry(
-                        _returnValue.node->keys[_returnValue.index].getBSON(),
-                        _returnValue.node->values_array[_returnValue.index]);
-    }
-    //only in backward
-    if (SimpleBSONObjComparator::kInstance.evaluate(key == max)) {
-        if (_endPosition && _inf == MAX_END && !inclusive)
-            return boost::none;
-
-        _tree->_cursor.node = _last;
-        _tree->_cursor.index = (_tree->_cursor.node)->num_keys - 1;
-        if (_endPosition
-                        && SimpleBSONObjComparator::kInstance.evaluate(
-                                        _tree->_cursor.node->keys[_tree->_cursor.index].getBSON()
-                                                        == _endPosition->getBSON()))
-            return boost::none;
-
-        _returnValue.node = _tree->_cursor.node;
-        _returnValue.index = _tree->_cursor.index;
-
-        moveToNext();
-        return IndexKeyEntry(
-                        _returnValue.node->keys[_returnValue.index].getBSON(),
-                        _returnValue.node->values_array[_returnValue.index]);
-    }
-
-    node = find_leaf(_tree->root, key, _ordering);
-    if (node == NULL)
-        return boost::none;
-
-    /*
-     * Check if in current node exist value that is equal or bigger than input key
-     */
-    for (i = 0; i < node->num_keys; i++) {
-        cmp = key.woCompare(node->keys[i].getBSON(), _ordering, false);
-        if (cmp <= 0) {
-            break;
-        }
-    }
-    /*
-     * Check if bigger or equal element was found : i will be > than num_keys
-     * If element was not found: return the last one
-     */
-    if (i == node->num_keys) {
-        _tree->_cursor.node = node;
-        _tree->_cursor.index = i - 1;
-        if (_forward) {
-            next(parts);
-            if (!_tree->_cursor.node) {
-                return boost::none;
-            }
+        if (_index < 0 || _index >= count) {
+            /* Leaf was read while it changed */
+            reposition();
+            continue;
         }
-        _returnValue.node = _tree->_cursor.node;
-        _returnValue.index = _tree->_cursor.index;
 
-        moveToNext();
-        return IndexKeyEntry(
-                        _returnValue.node->keys[_returnValue.index].getBSON(),
-                        _returnValue.node->values_array[_returnValue.index]);
-    }
-
-    /*
-     * Check if it is equal.
-     * If it is not equal then return bigger one or empty key if it is bigger than end position
-     * Check if next object has correct type. If not, go to next one.
-     */
-    if (cmp != 0) {
-        _tree->_cursor.node = node;
-        _tree->_cursor.index = i;
-
-        if (_endPosition
-                        && SimpleBSONObjComparator::kInstance.evaluate(
-                                        node->keys[i].getBSON()
-                                                        == _endPosition->getBSON())) {
-            return boost::none;
+        std::string key = _tree->leafKeyString(_node, _index);
+        std::string typeBits = _tree->leafTypeBits(_node, _index).toString();
+        RecordId loc = _tree->leafValue(_node, _index);
+        if (!table.validate(_node.get(), _version)) {
+            reposition();
+            continue;
         }
-
-        /*
-         * Check object type. If wrong return next.
-         * For "Backward" direction return previous object because we are just after bigger one.
-         */
-        if (correctType(
-                        _tree->_cursor.node->keys[_tree->_cursor.index].getBSON())) {
-            if (_forward) {
-                //TODO:add incrementing here
-                _returnValue.node = _tree->_cursor.node;
-                _returnValue.index = _tree->_cursor.index;
-
-                moveToNext();
-                return IndexKeyEntry(
-                                _returnValue.node->keys[_returnValue.index].getBSON(),
-                                _returnValue.node->values_array[_returnValue.index]);
-            } else {
-                _returnValue.node = _tree->_cursor.node;
-                _returnValue.index = _tree->_cursor.index;
-
-                return next();
-            }
-        } else
-            _returnValue.node = _tree->_cursor.node;
-        _returnValue.index = _tree->_cursor.index;
-
-        moveToNext();
-        return next();
-
-    }
-    /*
-     * So it is equal element
-     */
-    /*
-     * If inclusive - return next not-equal element (while)
-     */
-    if (!inclusive) {
-        _tree->_cursor.node = node;
-        _tree->_cursor.index = i;
-        while (key.woCompare(
-                        _tree->_cursor.node->keys[_tree->_cursor.index].getBSON(),
-                        _ordering, false) == 0) {
-            next(parts);
-            if (!_tree->_cursor.node) {
-                return boost::none;
+        if (_endPosition) {
+            int cmp = StringData(key).compare(*_endPosition);
+            if (_forward ? cmp > 0 : cmp < 0) {
+                _isEOF = true;
+                break;
             }
         }
-        _returnValue.node = _tree->_cursor.node;
-        _returnValue.index = _tree->_cursor.index;
-
-        moveToNext();
-        return IndexKeyEntry(
-                        _returnValue.node->keys[_returnValue.index].getBSON(),
-                        _returnValue.node->values_array[_returnValue.index]);
+        BSONObj bson;
+        if (parts & kWantKey)
+            bson = _tree->decodeKey(key, typeBits);
+        _lastKey = std::move(key);
+        _lastLoc = loc;
+        return IndexKeyEntry(bson, loc);
     }
+    return boost::none;
+}
 
-    /*
-     * It is not inclusive.
-     * Check if is first element in this node
-     */
-    if (_forward) {
-        if (i != 0) {
-            /*
-             * It is not first element. Return it.
-             */
-            _tree->_cursor.node = node;
-            _tree->_cursor.index = i;
-            _returnValue.node = _tree->_cursor.node;
-            _returnValue.index = _tree->_cursor.index;
-
-            moveToNext();
-            return IndexKeyEntry(
-                            _returnValue.node->keys[_returnValue.index].getBSON(),
-                            _returnValue.node->values_array[_returnValue.index]);
-        } else {
-            /*
-             * It is first element. We should check previous nodes (non-unique keys) - forward
-             */
-            _tree->_cursor.node = node;
-            _tree->_cursor.index = i;
-            _previousCursor.node = node;
-            _previousCursor.index = i;
-            previous();
-            /*
-             * Get previous until are not equal
-             */
-            while (!key.woCompare(
-                            _previousCursor.node->keys[_previousCursor.index].getBSON(),
-                            _ordering, false)) {
-                _tree->_cursor.node = _previousCursor.node;
-                _tree->_cursor.index = _previousCursor.index;
-                if (!previous()) {
-                    /*
-                     * There are no more prev
-                     */
-                    break;
-                }
-
-            }
-            _returnValue.node = _tree->_cursor.node;
-            _returnValue.index = _tree->_cursor.index;
+template <uint64_t ORDER>
+boost::optional<IndexKeyEntry> PmseCursor<ORDER>::seek(
+                const BSONObj& key, bool inclusive, RequestedInfo parts) {
+    locate(_tree->encodeKey(key, _forward == inclusive ?
+                    KeyString::kExclusiveBefore : KeyString::kExclusiveAfter));
+    return current(parts);
+}
 
-            moveToNext();
-            return IndexKeyEntry(
-                            _returnValue.node->keys[_returnValue.index].getBSON(),
-                            _returnValue.node->values_array[_returnValue.index]);
+/*
+ * Query object handles exclusive parts of seek point.
+ */
+template <uint64_t ORDER>
+boost::optional<IndexKeyEntry> PmseCursor<ORDER>::seek(
+                const IndexSeekPoint& seekPoint, RequestedInfo parts) {
+    BSONObj key = IndexEntryComparison::makeQueryObject(seekPoint, _forward);
+    locate(_tree->encodeKey(key, _forward ?
+                    KeyString::kExclusiveBefore : KeyString::kExclusiveAfter));
+    return current(parts);
+}
 
+/*
+ * Leaf key belongs to is probed by fingerprints. Run of equal keys which
+ * starts in it (ends, for backward cursor) places cursor on its entry.
+ * Run may also end in previous leaf or start in next one, so their edge
+ * keys are checked before key is reported missing.
+ */
+template <uint64_t ORDER>
+typename PmseCursor<ORDER>::ProbeResult PmseCursor<ORDER>::probe(const BSONObj& bsonKey,
+                                                                 StringData key) {
+    PmseLatchTable& table = _tree->_latches;
+    uint8_t fp = pmseKeyFingerprint(key);
+    auto edgeEqual = [&](PmseNodePtr<ORDER> node, bool last) {
+        uint64_t count = std::min<uint64_t>(node->num_keys, ORDER);
+        return count > 0 && _tree->equalAt(node, last ? count - 1 : 0, key, fp);
+    };
+    while (true) {
+        uint64_t version;
+        PmseNodePtr<ORDER> leaf = _tree->findLeaf(key, version);
+        if (leaf == nullptr)
+            return kMissing;
+        uint64_t count = std::min<uint64_t>(leaf->num_keys, ORDER);
+        uint64_t first = std::min(_tree->findEqual(leaf, 0, key, fp), count);
+        bool found = first < count;
+        uint64_t last = first;
+        while (found && last + 1 < count && _tree->equalAt(leaf, last + 1, key, fp))
+            last++;
+        /* Neighbors are read only when run can continue into them */
+        PmseNodePtr<ORDER> prev = nullptr;
+        PmseNodePtr<ORDER> next = nullptr;
+        uint64_t prevVersion = 0;
+        uint64_t nextVersion = 0;
+        if (!found || (_forward && first == 0)) {
+            prev = leaf->previous;
+            if (prev != nullptr)
+                prevVersion = table.readBegin(prev.get());
         }
-    }                //if(_forward){
-    else {
-        while (key.woCompare(node->keys[i].getBSON(), _ordering, false) == 0) {
-            _tree->_cursor.node = node;
-            _tree->_cursor.index = i;
-            /*
-             * There are next keys - increment i
-             */
-            if (i < (node->num_keys - 1)) {
-                i++;
-            } else {
-                /*
-                 * Move to next node - if it exist
-                 */
-                if (node->next != nullptr) {
-
-                    node = node->next;
-                    i = 0;
-                }
-            }
-
+        if (!found || (!_forward && last + 1 == count)) {
+            next = leaf->next;
+            if (next != nullptr)
+                nextVersion = table.readBegin(next.get());
         }
-        _returnValue.node = _tree->_cursor.node;
-        _returnValue.index = _tree->_cursor.index;
-
-        //TODO:add incrementing here
-        moveToNext();
-        return IndexKeyEntry(
-                        _returnValue.node->keys[_returnValue.index].getBSON(),
-                        _returnValue.node->values_array[_returnValue.index]);
+        if (!table.validate(leaf.get(), version))
+            continue;
+        bool crosses = (prev != nullptr && edgeEqual(prev, true))
+                        || (next != nullptr && edgeEqual(next, false));
+        if ((prev != nullptr && !table.validate(prev.get(), prevVersion))
+                        || (next != nullptr && !table.validate(next.get(), nextVersion)))
+            continue;
+        if (crosses)
+            return kCrossesLeaves;
+        if (!found)
+            return kMissing;
+        _node = leaf;
+        _version = version;
+        _index = _forward ? first : last;
+        _isEOF = false;
+        _moved = false;
+        /* Same bound as seek(), in case leaf changes before entry is returned */
+        _lastKey = _tree->encodeKey(bsonKey, _forward ? KeyString::kExclusiveBefore
+                                                      : KeyString::kExclusiveAfter);
+        _lastLoc = RecordId();
+        return kPlaced;
     }
-
-}
-
-boost::optional<IndexKeyEntry> PmseCursor::seek(
-                const IndexSeekPoint& seekPoint, RequestedInfo parts =
-                                kKeyAndLoc) {
-    std::cout << "seek not implemented";
-    std::cout << std::endl;
-    return boost::none;
 }
 
-boost::optional<IndexKeyEntry> PmseCursor::seekExact(
-                const BSONObj& key, RequestedInfo parts = kKeyAndLoc) {
-    auto kv = seek(key, true, kKeyAndLoc);
-    if (kv
-                    && kv->key.woCompare(key, BSONObj(), /*considerFieldNames*/
-                                    false) == 0)
+/*
+ * Missing keys are rejected by fingerprint probe without positioning
+ * search, cursor is placed from probe when run of key is in one leaf.
+ */
+template <uint64_t ORDER>
+boost::optional<IndexKeyEntry> PmseCursor<ORDER>::seekExact(
+                const BSONObj& key, RequestedInfo parts) {
+    std::string encoded = _tree->encodeKey(key);
+    boost::optional<IndexKeyEntry> kv;
+    switch (probe(key, encoded)) {
+        case kMissing:
+            _isEOF = true;
+            return boost::none;
+        case kPlaced:
+            kv = current(parts);
+            break;
+        case kCrossesLeaves:
+            kv = seek(key, true, parts);
+            break;
+    }
+    if (kv && _lastKey == encoded)
         return kv;
     return boost::none;
 }
 
-void PmseCursor::save() {
+template <uint64_t ORDER>
+void PmseCursor<ORDER>::save() {
 }
 
-void PmseCursor::saveUnpositioned() {
+template <uint64_t ORDER>
+void PmseCursor<ORDER>::saveUnpositioned() {
 }
 
-void PmseCursor::restore() {
+/*
+ * Tree nodes and keys seen by cursor are protected by epoch of
+ * recovery unit, it's entered again after snapshot was abandoned.
+ * Retired leaf was latched before, so its version tells it changed.
+ */
+template <uint64_t ORDER>
+void PmseCursor<ORDER>::restore() {
+    _ru->enterEpoch();
+    if (!_isEOF && !_tree->_latches.validate(_node.get(), _version))
+        _moved = true;
 }
 
-void PmseCursor::detachFromOperationContext() {
+template <uint64_t ORDER>
+void PmseCursor<ORDER>::detachFromOperationContext() {
+    _ru = nullptr;
 }
 
-void PmseCursor::reattachToOperationContext(OperationContext* opCtx) {
+template <uint64_t ORDER>
+void PmseCursor<ORDER>::reattachToOperationContext(OperationContext* opCtx) {
+    _ru = PmseRecoveryUnit::get(opCtx);
+    _ru->enterEpoch();
 }
+
+template class PmseCursor<16>;
+template class PmseCursor<32>;
+template class PmseCursor<64>;
+template class PmseCursor<128>;
 }
@@ -30,6 +30,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "mongo/db/storage/sorted_data_interface.h"
+#include "pmse_recovery_unit.h"
 #include "pmse_tree.h"
 
 #define MONGO_LOG_DEFAULT_COMPONENT ::mongo::logger::LogComponent::kStorage
@@ -37,15 +38,19 @@
 using namespace nvml::obj;
 
 namespace mongo {
+/*
+ * Cursor over tree of given fanout, created by PmseTreeImpl::newCursor.
+ * Leaves are read without latches, each entry is copied and checked
+ * against version of its leaf before it's returned.
+ */
+template <uint64_t ORDER>
 class PmseCursor final : public SortedDataInterface::Cursor {
 public:
-    PmseCursor(OperationContext* txn, bool isForward,
-               persistent_ptr<PmseTree> tree, const BSONObj& ordering,
-               const bool unique);
+    PmseCursor(OperationContext* txn, bool isForward, PmseTreeImpl<ORDER>* tree);
     void setEndPosition(const BSONObj& key, bool inclusive);
-    virtual boost::optional<IndexKeyEntry> next(RequestedInfo parts);
+    virtual boost::optional<IndexKeyEntry> next(RequestedInfo parts = kKeyAndLoc);
     boost::optional<IndexKeyEntry> seek(const BSONObj& key, bool inclusive,
-                                        RequestedInfo parts);
+                                        RequestedInfo parts = kKeyAndLoc);
     boost::optional<IndexKeyEntry> seek(const IndexSeekPoint& seekPoint,
                                         RequestedInfo parts);
     boost::optional<IndexKeyEntry> seekExact(const BSONObj& key,
@@ -61,36 +66,32 @@ public:
     void reattachToOperationContext(OperationContext* opCtx);
 
 private:
-    persistent_ptr<PmseTreeNode> find_leaf(persistent_ptr<PmseTreeNode> node,
-                                           const BSONObj& key,
-                                           const BSONObj& _ordering);
-    bool previous();
-    bool correctType(BSONObj record);
-    void moveToNext();
+    enum ProbeResult { kMissing, kPlaced, kCrossesLeaves };
+
+    ProbeResult probe(const BSONObj& bsonKey, StringData key);
+    void locate(StringData bound);
+    void reposition();
+    boost::optional<IndexKeyEntry> current(RequestedInfo parts);
 
     const bool _forward;
-    const BSONObj& _ordering;
-    persistent_ptr<PmseTreeNode> _first;
-    persistent_ptr<PmseTreeNode> _last;
-    const bool _unique;
-    persistent_ptr<PmseTree> _tree;
-    BSONType cursorType;
+    PmseTreeImpl<ORDER>* _tree;
+    PmseRecoveryUnit* _ru = nullptr;
     /*
-     * Marks end position for seek and next. Set by setEndPosition().
-     * */
-    BSONObj_PM* _endPosition;
-    uint64_t _inf;
+     * Entry cursor is on: index in leaf read at _version. Index past end
+     * of leaf in direction of cursor means first entry of next leaf.
+     */
+    PmseNodePtr<ORDER> _node;
+    uint64_t _version = 0;
+    int64_t _index = 0;
     bool _isEOF = true;
+    /* Leaf changed while cursor was saved */
+    bool _moved = false;
+    /* Last returned entry, cursor is placed after it when its leaf changes */
+    std::string _lastKey;
+    RecordId _lastLoc;
     /*
-     * Cursor used for iterating with next until "_endPosition"
+     * Encoded bound entries must not pass, set by setEndPosition().
      */
-
-    CursorObject _previousCursor;
-    CursorObject _returnValue;
-    BSONObj min;
-    BSONObj max;
-    BSONObj_PM end_min_pm;
-    BSONObj_PM end_max_pm;
-
+    boost::optional<std::string> _endPosition;
 };
 }
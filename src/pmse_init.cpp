@@ -31,12 +31,14 @@
  */
 
 #include "pmse_engine.h"
+#include "pmse_server_status.h"
 
 #include "mongo/base/init.h"
 #include "mongo/db/service_context_d.h"
 #include "mongo/db/service_context.h"
 #include "mongo/db/storage/devnull/devnull_kv_engine.h"
 #include "mongo/db/storage/kv/kv_storage_engine.h"
+#include "mongo/db/storage/storage_engine_metadata.h"
 #include "mongo/db/storage/storage_options.h"
 
 #include <iostream>
@@ -56,6 +58,8 @@ public:
         options.directoryPerDB = params.directoryperdb;
         options.forRepair = params.repair;
         std::cout << params.dbpath << std::endl;
+        // Intentionally leaked.
+        new PmseServerStatusSection();
         return new KVStorageEngine(new PmseEngine(params.dbpath), options);
     }
 
@@ -63,15 +67,20 @@ public:
         return storeName;
     }
 
+    /*
+     * Pool files can't be found when directoryPerDB differs from
+     * setting data files were created with.
+     */
     virtual Status validateMetadata(const StorageEngineMetadata& metadata,
                                     const StorageGlobalParams& params) const {
-        // TODO: Implement validateMetadata
-        return Status::OK();
+        return metadata.validateStorageEngineOption("directoryPerDB",
+                                                    params.directoryperdb);
     }
 
     virtual BSONObj createMetadataOptions(const StorageGlobalParams& params) const {
-        // TODO: Implement createMetadataOptions
-        return BSONObj();
+        BSONObjBuilder builder;
+        builder.appendBool("directoryPerDB", params.directoryperdb);
+        return builder.obj();
     }
 };
 }  // namespace
@@ -0,0 +1,289 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "mongo/platform/basic.h"
+
+#include "pmse_inner_index.h"
+#include "pmse_tree.h"
+
+#include <algorithm>
+
+namespace mongo {
+
+/*
+ * Builds tree bottom up, nodes are filled leaving one free slot.
+ */
+template <uint64_t ORDER>
+void PmseInnerIndex<ORDER>::build(const std::vector<Leaf*>& leaves,
+                                  std::vector<std::string>& separators) {
+    clear();
+    if (leaves.empty())
+        return;
+    std::vector<Child> children(leaves.size());
+    for (uint64_t i = 0; i < leaves.size(); i++)
+        children[i].leaf = leaves[i];
+    bool leafChildren = true;
+    do {
+        uint64_t count = (children.size() + ORDER - 1) / ORDER;
+        std::vector<Child> parents(count);
+        std::vector<std::string> parentSeparators;
+        parentSeparators.reserve(count - 1);
+        for (uint64_t n = 0; n < count; n++) {
+            uint64_t begin = n * ORDER;
+            uint64_t end = std::min(begin + ORDER, static_cast<uint64_t>(children.size()));
+            Node* node = new Node(leafChildren);
+            for (uint64_t i = begin; i < end; i++) {
+                adopt(node, i - begin, children[i]);
+                if (i + 1 < end) {
+                    node->heads[i - begin] = pmseKeyHead(separators[i]);
+                    node->keys[i - begin] = std::move(separators[i]);
+                }
+            }
+            node->num_keys = end - begin - 1;
+            if (end < children.size())
+                parentSeparators.push_back(std::move(separators[end - 1]));
+            parents[n].node = node;
+        }
+        children.swap(parents);
+        separators.swap(parentSeparators);
+        leafChildren = false;
+    } while (children.size() > 1);
+    _root = children[0].node;
+}
+
+/*
+ * Same descent as PmseTreeImpl::childIndex.
+ */
+template <uint64_t ORDER>
+typename PmseInnerIndex<ORDER>::Leaf* PmseInnerIndex<ORDER>::findLeaf(
+                StringData key) const {
+    Node* current = _root;
+    bool wasEqual = false;
+    uint64_t head = pmseKeyHead(key);
+
+    if (current == nullptr)
+        return nullptr;
+    while (true) {
+        int cmp;
+        uint64_t i = pmseLowerBound(current->heads, current->num_keys, key, head,
+                                    [&](uint64_t index) {
+                                        return StringData(current->keys[index]);
+                                    }, cmp);
+        if (cmp == 0 && !wasEqual) {
+            wasEqual = true;
+            i++;
+        }
+        if (current->leafChildren)
+            return current->children[i].leaf;
+        current = current->children[i].node;
+    }
+}
+
+template <uint64_t ORDER>
+void PmseInnerIndex<ORDER>::insertLeaf(Leaf* left, StringData key, Leaf* right) {
+    Node* parent = _parentOf[left];
+    Child child;
+    child.leaf = right;
+    insertChild(parent, indexOfLeaf(parent, left), key, child);
+}
+
+/*
+ * Nodes aren't merged, node is freed when its last child is removed.
+ */
+template <uint64_t ORDER>
+void PmseInnerIndex<ORDER>::removeLeaf(Leaf* leaf) {
+    auto it = _parentOf.find(leaf);
+    if (it == _parentOf.end())
+        return;
+    Node* parent = it->second;
+    _parentOf.erase(it);
+    removeChild(parent, indexOfLeaf(parent, leaf));
+    while (_root && !_root->leafChildren && _root->num_keys == 0) {
+        Node* child = _root->children[0].node;
+        delete _root;
+        _root = child;
+        _root->parent = nullptr;
+    }
+}
+
+template <uint64_t ORDER>
+void PmseInnerIndex<ORDER>::clear() {
+    freeSubtree(_root);
+    _root = nullptr;
+    _parentOf.clear();
+}
+
+template <uint64_t ORDER>
+void PmseInnerIndex<ORDER>::adopt(Node* node, uint64_t index, Child child) {
+    node->children[index] = child;
+    if (node->leafChildren)
+        _parentOf[child.leaf] = node;
+    else
+        child.node->parent = node;
+}
+
+template <uint64_t ORDER>
+uint64_t PmseInnerIndex<ORDER>::indexOfLeaf(Node* node, const Leaf* leaf) const {
+    uint64_t i = 0;
+    while (i < node->num_keys && node->children[i].leaf != leaf)
+        i++;
+    return i;
+}
+
+template <uint64_t ORDER>
+uint64_t PmseInnerIndex<ORDER>::indexOfNode(Node* node, const Node* child) const {
+    uint64_t i = 0;
+    while (i < node->num_keys && node->children[i].node != child)
+        i++;
+    return i;
+}
+
+/*
+ * Inserts key and right child after child at left_index, full node
+ * is split and its middle key moves to parent.
+ */
+template <uint64_t ORDER>
+void PmseInnerIndex<ORDER>::insertChild(Node* node, uint64_t left_index, StringData key,
+                                        Child right) {
+    uint64_t i, j;
+
+    if (node->num_keys < ORDER) {
+        for (i = node->num_keys; i > left_index; i--) {
+            node->keys[i] = std::move(node->keys[i - 1]);
+            node->heads[i] = node->heads[i - 1];
+            node->children[i + 1] = node->children[i];
+        }
+        node->keys[left_index] = key.toString();
+        node->heads[left_index] = pmseKeyHead(key);
+        adopt(node, left_index + 1, right);
+        node->num_keys++;
+        return;
+    }
+
+    std::string temp_keys[ORDER + 1];
+    uint64_t temp_heads[ORDER + 1];
+    Child temp_children[ORDER + 2];
+    for (i = 0, j = 0; i < ORDER; i++, j++) {
+        if (j == left_index)
+            j++;
+        temp_keys[j] = std::move(node->keys[i]);
+        temp_heads[j] = node->heads[i];
+    }
+    temp_keys[left_index] = key.toString();
+    temp_heads[left_index] = pmseKeyHead(key);
+    for (i = 0, j = 0; i <= ORDER; i++, j++) {
+        if (j == left_index + 1)
+            j++;
+        temp_children[j] = node->children[i];
+    }
+    temp_children[left_index + 1] = right;
+
+    uint64_t split = (ORDER + 1) / 2;
+    Node* sibling = new Node(node->leafChildren);
+    for (i = 0; i < split; i++) {
+        node->keys[i] = std::move(temp_keys[i]);
+        node->heads[i] = temp_heads[i];
+    }
+    for (; i < ORDER; i++)
+        node->keys[i] = std::string();
+    for (i = 0; i <= split; i++)
+        adopt(node, i, temp_children[i]);
+    node->num_keys = split;
+    for (i = split + 1, j = 0; i <= ORDER; i++, j++) {
+        sibling->keys[j] = std::move(temp_keys[i]);
+        sibling->heads[j] = temp_heads[i];
+    }
+    for (i = split + 1, j = 0; i <= ORDER + 1; i++, j++)
+        adopt(sibling, j, temp_children[i]);
+    sibling->num_keys = ORDER - split;
+
+    Child up;
+    up.node = sibling;
+    if (node == _root) {
+        Node* root = new Node(false);
+        Child down;
+        down.node = node;
+        root->keys[0] = std::move(temp_keys[split]);
+        root->heads[0] = temp_heads[split];
+        adopt(root, 0, down);
+        adopt(root, 1, up);
+        root->num_keys = 1;
+        _root = root;
+        return;
+    }
+    insertChild(node->parent, indexOfNode(node->parent, node), temp_keys[split], up);
+}
+
+/*
+ * Removes child and key separating it from its left neighbor, or from
+ * right one if child is leftmost.
+ */
+template <uint64_t ORDER>
+void PmseInnerIndex<ORDER>::removeChild(Node* node, uint64_t index) {
+    uint64_t i;
+
+    if (node->num_keys == 0) {
+        if (node->parent)
+            removeChild(node->parent, indexOfNode(node->parent, node));
+        else
+            _root = nullptr;
+        delete node;
+        return;
+    }
+    for (i = index > 0 ? index - 1 : 0; i + 1 < node->num_keys; i++) {
+        node->keys[i] = std::move(node->keys[i + 1]);
+        node->heads[i] = node->heads[i + 1];
+    }
+    node->keys[node->num_keys - 1] = std::string();
+    for (i = index; i < node->num_keys; i++)
+        node->children[i] = node->children[i + 1];
+    node->num_keys--;
+}
+
+template <uint64_t ORDER>
+void PmseInnerIndex<ORDER>::freeSubtree(Node* node) {
+    if (node == nullptr)
+        return;
+    if (!node->leafChildren) {
+        for (uint64_t i = 0; i <= node->num_keys; i++)
+            freeSubtree(node->children[i].node);
+    }
+    delete node;
+}
+
+template class PmseInnerIndex<16>;
+template class PmseInnerIndex<32>;
+template class PmseInnerIndex<64>;
+template class PmseInnerIndex<128>;
+
+}
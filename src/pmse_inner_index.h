@@ -0,0 +1,106 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_INNER_INDEX_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_INNER_INDEX_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mongo/base/disallow_copying.h"
+#include "mongo/base/string_data.h"
+
+namespace mongo {
+
+template <uint64_t ORDER> struct PmseTreeNode;
+
+/*
+ * Inner nodes of tree kept in DRAM, over persistent chain of leaves.
+ * Nothing is persisted, nodes are rebuilt from leaves when index is opened.
+ */
+template <uint64_t ORDER>
+class PmseInnerIndex {
+    MONGO_DISALLOW_COPYING(PmseInnerIndex);
+
+public:
+    typedef PmseTreeNode<ORDER> Leaf;
+
+    PmseInnerIndex() = default;
+
+    ~PmseInnerIndex() {
+        clear();
+    }
+
+    /* separators[i] is first key of leaves[i + 1], it's moved from */
+    void build(const std::vector<Leaf*>& leaves, std::vector<std::string>& separators);
+    Leaf* findLeaf(StringData key) const;
+    /* Adds leaf split from left, key is its first key */
+    void insertLeaf(Leaf* left, StringData key, Leaf* right);
+    void removeLeaf(Leaf* leaf);
+    void clear();
+
+private:
+    struct Node;
+
+    union Child {
+        Node* node;
+        Leaf* leaf;
+    };
+
+    struct Node {
+        explicit Node(bool leaves) : leafChildren(leaves) {}
+
+        uint64_t num_keys = 0;
+        bool leafChildren;
+        Node* parent = nullptr;
+        std::string keys[ORDER];
+        /* pmseKeyHead() of keys, searched first */
+        uint64_t heads[ORDER];
+        Child children[ORDER + 1];
+    };
+
+    void adopt(Node* node, uint64_t index, Child child);
+    uint64_t indexOfLeaf(Node* node, const Leaf* leaf) const;
+    uint64_t indexOfNode(Node* node, const Node* child) const;
+    void insertChild(Node* node, uint64_t left_index, StringData key, Child right);
+    void removeChild(Node* node, uint64_t index);
+    void freeSubtree(Node* node);
+
+    Node* _root = nullptr;
+    /* Parents of leaves, leaves themselves are persistent */
+    std::unordered_map<const Leaf*, Node*> _parentOf;
+};
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_INNER_INDEX_H_ */
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "mongo/platform/basic.h"
+
+#include "pmse_latch.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace mongo {
+
+namespace {
+
+/* Busy waits this many times before giving up CPU */
+const int SPINS_BEFORE_YIELD = 64;
+
+void backoff(int& spins) {
+    if (++spins >= SPINS_BEFORE_YIELD) {
+        spins = 0;
+        std::this_thread::yield();
+    }
+}
+
+}  // namespace
+
+PmseLatchTable::PmseLatchTable(uint64_t words) {
+    int bits = 1;
+    while (bits < 32 && (1ULL << bits) < words)
+        bits++;
+    _shift = 64 - bits;
+    _words.reset(new std::atomic<uint64_t>[1ULL << bits]);
+    for (uint64_t i = 0; i < (1ULL << bits); i++)
+        _words[i].store(0, std::memory_order_relaxed);
+}
+
+uint64_t PmseLatchTable::readBegin(const void* node) const {
+    uint64_t version;
+    int spins = 0;
+    while (!tryReadBegin(node, version))
+        backoff(spins);
+    return version;
+}
+
+bool PmseLatchSet::tryUpgrade(const void* node, uint64_t version) {
+    std::atomic<uint64_t>* word = &_table.word(node);
+    if (holds(word))
+        return false;
+    if (!word->compare_exchange_strong(version, version + 1, std::memory_order_acquire))
+        return false;
+    std::atomic_thread_fence(std::memory_order_release);
+    _words.push_back(word);
+    return true;
+}
+
+void PmseLatchSet::lock(const void* node) {
+    std::atomic<uint64_t>* word = &_table.word(node);
+    if (holds(word))
+        return;
+    int spins = 0;
+    while (true) {
+        uint64_t version = word->load(std::memory_order_relaxed);
+        if ((version & 1) == 0
+                        && word->compare_exchange_weak(version, version + 1,
+                                                       std::memory_order_acquire))
+            break;
+        backoff(spins);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    _words.push_back(word);
+}
+
+void PmseLatchSet::lockStructure(stdx::mutex& mutex) {
+    _structure = stdx::unique_lock<stdx::mutex>(mutex);
+}
+
+void PmseLatchSet::commit() {
+    for (auto& change : _afterCommit)
+        change();
+    _afterCommit.clear();
+}
+
+void PmseLatchSet::release() {
+    _afterCommit.clear();
+    for (auto word : _words)
+        word->fetch_add(1, std::memory_order_release);
+    _words.clear();
+    if (_structure.owns_lock())
+        _structure.unlock();
+}
+
+bool PmseLatchSet::holds(const std::atomic<uint64_t>* word) const {
+    return std::find(_words.begin(), _words.end(), word) != _words.end();
+}
+
+void PmseSharedLatch::lockShared() {
+    int spins = 0;
+    while (true) {
+        uint64_t state = _state.load(std::memory_order_relaxed);
+        if ((state & WRITER) == 0
+                        && _state.compare_exchange_weak(state, state + 1,
+                                                        std::memory_order_acquire))
+            return;
+        backoff(spins);
+    }
+}
+
+/*
+ * Writer bit stops new readers, then readers inside are waited for.
+ */
+void PmseSharedLatch::lock() {
+    int spins = 0;
+    while ((_state.fetch_or(WRITER, std::memory_order_acquire) & WRITER) != 0)
+        backoff(spins);
+    while (_state.load(std::memory_order_acquire) != WRITER)
+        backoff(spins);
+}
+
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_LATCH_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_LATCH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "mongo/base/disallow_copying.h"
+#include "mongo/stdx/mutex.h"
+
+namespace mongo {
+
+/*
+ * Version words of nodes of one tree, kept in DRAM so pool layout
+ * doesn't change. Node is mapped to word by its address, nodes sharing
+ * word are latched together: writer of one waits for writer of other
+ * and readers of both repeat their search. Word is odd while node is
+ * latched and unlatching moves it to next even value, so reader which
+ * saw same even value before and after reading node read consistent
+ * state.
+ */
+class PmseLatchTable {
+    MONGO_DISALLOW_COPYING(PmseLatchTable);
+
+public:
+    /* Number of words is rounded up to power of two */
+    explicit PmseLatchTable(uint64_t words);
+
+    /* Version of node, waits while node is latched */
+    uint64_t readBegin(const void* node) const;
+
+    /* Same as readBegin(), false instead of waiting */
+    bool tryReadBegin(const void* node, uint64_t& version) const {
+        version = word(node).load(std::memory_order_acquire);
+        return (version & 1) == 0;
+    }
+
+    /* True if node wasn't latched since version was read */
+    bool validate(const void* node, uint64_t version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return word(node).load(std::memory_order_relaxed) == version;
+    }
+
+    std::atomic<uint64_t>& word(const void* node) const {
+        uint64_t address = reinterpret_cast<uintptr_t>(node) >> 6;
+        return _words[(address * 0x9E3779B97F4A7C15ULL) >> _shift];
+    }
+
+private:
+    int _shift;
+    std::unique_ptr<std::atomic<uint64_t>[]> _words;
+};
+
+/*
+ * Latches taken by one index write in latch table of its tree. They are
+ * released together after its transaction ends, so readers never see
+ * changes which can still be rolled back. Structure changes of tree are
+ * serialized by its mutex, held by set the same way. Changes of DRAM
+ * structures made by the write are queued and applied by commit(), so
+ * aborted transaction leaves them untouched.
+ */
+class PmseLatchSet {
+    MONGO_DISALLOW_COPYING(PmseLatchSet);
+
+public:
+    explicit PmseLatchSet(PmseLatchTable& table) : _table(table) {}
+
+    ~PmseLatchSet() {
+        release();
+    }
+
+    /* Latches node if it's still at version read by readBegin() */
+    bool tryUpgrade(const void* node, uint64_t version);
+    /* Waits for latch of node, nothing is done if set holds it already */
+    void lock(const void* node);
+    void lockStructure(stdx::mutex& mutex);
+    void afterCommit(std::function<void()> change) {
+        _afterCommit.push_back(std::move(change));
+    }
+    /* Applies queued changes, called after commit and before release() */
+    void commit();
+    /* Queued changes not applied by commit() are dropped */
+    void release();
+
+private:
+    bool holds(const std::atomic<uint64_t>* word) const;
+
+    PmseLatchTable& _table;
+    std::vector<std::atomic<uint64_t>*> _words;
+    stdx::unique_lock<stdx::mutex> _structure;
+    std::vector<std::function<void()>> _afterCommit;
+};
+
+/*
+ * Reader-writer latch of DRAM structure searched in place. Holders of
+ * shared latch mustn't wait for anything else.
+ */
+class PmseSharedLatch {
+    MONGO_DISALLOW_COPYING(PmseSharedLatch);
+
+public:
+    PmseSharedLatch() = default;
+
+    void lockShared();
+    void unlockShared() {
+        _state.fetch_sub(1, std::memory_order_release);
+    }
+    void lock();
+    void unlock() {
+        _state.fetch_and(~WRITER, std::memory_order_release);
+    }
+
+private:
+    static const uint64_t WRITER = 1ULL << 63;
+
+    std::atomic<uint64_t> _state{0};
+};
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_LATCH_H_ */
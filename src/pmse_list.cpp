@@ -152,4 +152,11 @@ void PmseList::setPool(pool<PmseList> pool_obj) {
     this->pool_obj = pool_obj;
 }
 
+uint64_t PmseList::nextGeneration() {
+    transaction::exec_tx(pool_obj, [&] {
+        generation = generation + 1;
+    });
+    return generation;
+}
+
 }
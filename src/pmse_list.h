@@ -77,10 +77,13 @@ public:
     const char* find(const char key[], bool &status);
     void clear();
     void setPool(pool<PmseList> pool_obj);
+    uint64_t nextGeneration();
 private:
     persistent_ptr<KVPair> head;
     persistent_ptr<KVPair> tail;
     p<uint64_t> counter;
+    /* Number of times engine was started */
+    p<uint64_t> generation;
     pool<PmseList> pool_obj;
     PmseList() {}
 };
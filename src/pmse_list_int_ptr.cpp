@@ -44,15 +44,26 @@
 
 namespace mongo {
 
+void deleteVersions(persistent_ptr<InitData> obj) {
+    while (obj != nullptr) {
+        persistent_ptr<InitData> older(obj->older);
+        delete_persistent<InitData>(obj);
+        obj = older;
+    }
+}
+
 PmseListIntPtr::PmseListIntPtr() : counter(1) {
-    pop = pool_by_vptr(this);
 };
 
 PmseListIntPtr::~PmseListIntPtr() {
 }
 
-void PmseListIntPtr::setPool() {
-    pop = pool_by_vptr(this);
+/*
+ * Pool is resolved from object address, so buckets don't need any
+ * volatile state restored when the map is opened.
+ */
+pool_base PmseListIntPtr::pop() {
+    return pool_by_vptr(this);
 }
 
 uint64_t PmseListIntPtr::size() {
@@ -61,7 +72,7 @@ uint64_t PmseListIntPtr::size() {
 
 void PmseListIntPtr::insertKV(persistent_ptr<KVPair> &key, persistent_ptr<InitData> &value) {
     try {
-        transaction::exec_tx(pop, [&] {
+        transaction::exec_tx(pop(), [&] {
             key->ptr = value;
             key->next = nullptr;
             if (head != nullptr) {
@@ -78,12 +89,26 @@ void PmseListIntPtr::insertKV(persistent_ptr<KVPair> &key, persistent_ptr<InitDa
     }
 }
 
+/*
+ * Same change as insertKV, as redo actions. Pair must be filled and
+ * persisted already.
+ */
+void PmseListIntPtr::appendActions(PMEMobjpool* pop, PMEMoid pair,
+                                   std::vector<pobj_action>& acts) {
+    if (head != nullptr)
+        addOidAction(pop, acts, &tail->next, pair);
+    else
+        addOidAction(pop, acts, &head, pair);
+    addOidAction(pop, acts, &tail, pair);
+    addValueAction(pop, acts, &_size, _size + 1);
+}
+
 void PmseListIntPtr::insertKV_capped(persistent_ptr<KVPair> &key,
                                      persistent_ptr<InitData> &value,
                                      bool isCapped, uint64_t maxDoc,
                                      uint64_t sizeOfColl) {
     try {
-        transaction::exec_tx(pop, [&] {
+        transaction::exec_tx(pop(), [&] {
             key->ptr = value;
             key->next = nullptr;
 
@@ -142,12 +167,17 @@ void PmseListIntPtr::insertKV_capped(persistent_ptr<KVPair> &key,
     }
 }
 
-int64_t PmseListIntPtr::deleteKV(uint64_t key, persistent_ptr<KVPair> &deleted) {
+/*
+ * Pair and record data are retired, not freed, readers may still
+ * reference them. Next pointer of pair is kept, so reader standing on
+ * it can go on with the chain.
+ */
+int64_t PmseListIntPtr::deleteKV(uint64_t key, PmseLimbo &limbo) {
     auto before = head;
     int64_t sizeFreed = 0;
     for (auto rec = head; rec != nullptr; rec = rec->next) {
         if (rec->idValue == key) {
-            transaction::exec_tx(pop, [&] {
+            transaction::exec_tx(pop(), [&] {
                 if (before != head) {
                     before->next = rec->next;
                     if (before->next == nullptr)
@@ -169,15 +199,10 @@ int64_t PmseListIntPtr::deleteKV(uint64_t key, persistent_ptr<KVPair> &deleted)
                     }
                 }
                 _size--;
-                if(deleted != nullptr) {
-                    rec->next = deleted;
-                    deleted = rec;
-                } else {
-                    rec->next = nullptr;
-                    deleted = rec;
-                }
-                sizeFreed = pmemobj_alloc_usable_size(deleted->ptr.raw());
-                delete_persistent<InitData>(deleted->ptr);
+                sizeFreed = pmemobj_alloc_usable_size(rec->ptr.raw());
+                for (auto v = rec->ptr; v != nullptr; v = persistent_ptr<InitData>(v->older))
+                    limbo.retire(v.raw());
+                limbo.retire(rec.raw());
             });
             break;
         } else {
@@ -218,19 +243,17 @@ bool PmseListIntPtr::getPair(uint64_t key, persistent_ptr<KVPair> &item_ptr) {
     return false;
 }
 
+/*
+ * New version is linked in front of current one, older versions are
+ * left to the caller to prune. Value must be allocated in current transaction.
+ */
 void PmseListIntPtr::update(uint64_t key, persistent_ptr<InitData> &value) {
     for (auto rec = head; rec != nullptr; rec = rec->next) {
         if (rec->idValue == key) {
-            if(rec->ptr != nullptr) {
-                try {
-                    transaction::exec_tx(pop, [&] {
-                        delete_persistent<InitData>(rec->ptr);
-                    });
-                } catch(std::exception &e) {
-                    std::cout << e.what() << std::endl;
-                }
-            }
-            rec->ptr = value;
+            transaction::exec_tx(pop(), [&] {
+                value->older = rec->ptr.raw();
+                rec->ptr = value;
+            });
             return;
         }
     }
@@ -239,7 +262,7 @@ void PmseListIntPtr::update(uint64_t key, persistent_ptr<InitData> &value) {
 void PmseListIntPtr::clear() {
     if (!head)
         return;
-    transaction::exec_tx(pop, [&] {
+    transaction::exec_tx(pop(), [&] {
         for(auto rec = head; rec != nullptr;) {
             auto temp = rec->next;
             delete_persistent<KVPair>(rec);
@@ -50,15 +50,34 @@
 #include <libpmemobj++/transaction.hpp>
 #include <libpmemobj++/utils.hpp>
 
+#include "pmse_epoch.h"
+
 using namespace nvml::obj;
 
 namespace mongo {
 
+const uint32_t INIT_DATA_CHECKSUM = 1;     //checksum field is valid
+const uint32_t INIT_DATA_TOMBSTONE = 2;    //record was deleted, version has no data
+
 struct InitData {
     uint64_t size;
+    uint32_t checksum;
+    uint32_t flags;
+    uint64_t stamp;     //commit stamp, see pmse_snapshot.h
+    PMEMoid older;      //previous version of record
     char data[];
 };
 
+inline bool isTombstone(const InitData* obj) {
+    return obj->flags & INIT_DATA_TOMBSTONE;
+}
+
+/*
+ * Frees record together with all its older versions.
+ * Must be called inside transaction.
+ */
+void deleteVersions(persistent_ptr<InitData> obj);
+
 struct _pair {
     p<uint64_t> idValue;
     persistent_ptr<InitData> ptr;
@@ -67,6 +86,22 @@ struct _pair {
 
 typedef struct _pair KVPair;
 
+/*
+ * Helpers for building redo actions published with pmemobj_publish.
+ */
+inline void addValueAction(PMEMobjpool* pop, std::vector<pobj_action>& acts,
+                           void* dst, uint64_t value) {
+    acts.emplace_back();
+    pmemobj_set_value(pop, &acts.back(), static_cast<uint64_t*>(dst), value);
+}
+
+inline void addOidAction(PMEMobjpool* pop, std::vector<pobj_action>& acts,
+                         void* dst, PMEMoid value) {
+    PMEMoid* oid = static_cast<PMEMoid*>(dst);
+    addValueAction(pop, acts, &oid->pool_uuid_lo, value.pool_uuid_lo);
+    addValueAction(pop, acts, &oid->off, value.off);
+}
+
 class PmseListIntPtr {
     template<typename T>
     friend class PmseMap;
@@ -79,14 +114,15 @@ public:
     bool find(uint64_t key, persistent_ptr<InitData> &item_ptr);
     bool getPair(uint64_t key, persistent_ptr<KVPair> &item_ptr);
     void update(uint64_t key, persistent_ptr<InitData> &value);
-    int64_t deleteKV(uint64_t key, persistent_ptr<KVPair> &deleted);
+    int64_t deleteKV(uint64_t key, PmseLimbo &limbo);
     bool hasKey(uint64_t key);
     void clear();
-    void setPool();
     uint64_t size();
     uint64_t getNextId();
+    void appendActions(PMEMobjpool* pop, PMEMoid pair, std::vector<pobj_action>& acts);
 
 private:
+    pool_base pop();
     persistent_ptr<KVPair> getHead() {
         return head;
     }
@@ -97,7 +133,6 @@ private:
     p<uint64_t> counterDeleted;
     p<uint64_t> counter;
     p<uint64_t> _size;
-    pool_base pop;
 
     p<uint64_t> sizeOfFirstData;
     enum FreeSpace {
@@ -40,12 +40,22 @@
 #ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_MAP_H_
 #define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_MAP_H_
 
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pmse_dram_index.h"
 #include "pmse_list_int_ptr.h"
+#include "pmse_parallel.h"
+#include "pmse_prefault.h"
+#include "pmse_snapshot.h"
 #include <libpmemobj++/p.hpp>
 #include <libpmemobj++/pext.hpp>
 #include <libpmemobj++/pool.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
 #include <libpmemobj++/make_persistent_array.hpp>
+#include <libpmemobj++/mutex.hpp>
 #include <libpmemobj++/detail/pexceptions.hpp>
 
 using namespace nvml::obj;
@@ -54,16 +64,44 @@ namespace mongo {
 
 const uint64_t CAPPED_SIZE = 1;
 const uint64_t HASHMAP_SIZE = 1000;
+const uint64_t RECLAIM_BATCH_SIZE = 1024;
+const size_t MAX_VALIDATE_ERRORS = 100;
+const uint64_t COMPACT_BATCH_SIZE = 256;
+const size_t PUBLISH_MAX_ACTIONS = 16;
+const int NT_COPY_THRESHOLD = 4096;     //documents copied with non-temporal stores
 class PmseRecordCursor;
 
+/*
+ * Result of structure check of range of buckets.
+ */
+struct PmseBucketCheck {
+    uint64_t records = 0;
+    int64_t dataSize = 0;
+    uint64_t errorCount = 0;
+    std::vector<std::string> errors;
+
+    void addError(std::string error) {
+        errorCount++;
+        if (errors.size() < MAX_VALIDATE_ERRORS)
+            errors.push_back(std::move(error));
+    }
+};
+
 template<typename T>
 class PmseMap {
     friend PmseRecordCursor;
 public:
     PmseMap() = default;
 
-    PmseMap(bool isCapped, uint64_t maxDoc, uint64_t sizeOfColl, uint64_t size = HASHMAP_SIZE)
+    /*
+     * Map of one stripe of collection striped over stride pools gets ids
+     * equal to offset modulo stride.
+     */
+    PmseMap(bool isCapped, uint64_t maxDoc, uint64_t sizeOfColl, uint64_t size = HASHMAP_SIZE,
+            uint64_t stride = 1, uint64_t offset = 0)
             : _size(isCapped ? CAPPED_SIZE : size), _isCapped(isCapped) {
+        _stride = stride;
+        _offset = offset;
         _maxDocuments = maxDoc;
         _sizeOfCollection = sizeOfColl;
         try {
@@ -75,25 +113,92 @@ public:
 
     ~PmseMap() = default;
 
+    /*
+     * Insert without undo log. Record and its pair are reserved and filled
+     * outside of transaction, then both allocations, bucket link and map
+     * counters are published in one redo log. fill() must flush record,
+     * it's drained together with the pair before publishing. Id is taken
+     * and counters are published under write lock of the map.
+     * Used only for new ids of not capped maps, returns 0 when insert
+     * has to go through transactional path.
+     */
+    template<typename Fill>
+    uint64_t insertReserved(size_t size, Fill fill) {
+        if (_isCapped)
+            return 0;
+        PMEMobjpool* pm_pool = pop.get_handle();
+        std::vector<pobj_action> acts;
+        acts.reserve(PUBLISH_MAX_ACTIONS);
+
+        acts.emplace_back();
+        PMEMoid dataOid = pmemobj_reserve(pm_pool, &acts.back(), size, 1);
+        if (OID_IS_NULL(dataOid))
+            return 0;
+        acts.emplace_back();
+        PMEMoid pairOid = pmemobj_reserve(pm_pool, &acts.back(), sizeof(KVPair),
+                                          nvml::detail::type_num<KVPair>());
+        if (OID_IS_NULL(pairOid)) {
+            pmemobj_cancel(pm_pool, acts.data(), 1);
+            return 0;
+        }
+        fill(static_cast<T*>(pmemobj_direct(dataOid)));
+
+        std::unique_lock<nvml::obj::mutex> lock(_writeLock);
+        if (idsExhausted()) {
+            pmemobj_cancel(pm_pool, acts.data(), acts.size());
+            return 0;
+        }
+        uint64_t id = idOf(_counter + 1);
+        KVPair* pair = static_cast<KVPair*>(pmemobj_direct(pairOid));
+        memset(pair, 0, sizeof(KVPair));
+        pair->idValue = id;
+        pair->ptr = persistent_ptr<T>(dataOid);
+        pmemobj_flush(pm_pool, pair, sizeof(KVPair));
+        pmemobj_drain(pm_pool);
+
+        _list[bucketOf(id)]->appendActions(pm_pool, pairOid, acts);
+        addValueAction(pm_pool, acts, &_counter, _counter + 1);
+        addValueAction(pm_pool, acts, &_hashmapSize, _hashmapSize + 1);
+        addValueAction(pm_pool, acts, &_dataSize,
+                       _dataSize + pmemobj_alloc_usable_size(dataOid));
+        if (pmemobj_publish(pm_pool, acts.data(), acts.size())) {
+            pmemobj_cancel(pm_pool, acts.data(), acts.size());
+            return 0;
+        }
+        if (_dramIndex)
+            _dramIndex->insert(id, pairOid);
+        return id;
+    }
+
+    /*
+     * Write lock is held until outermost transaction ends.
+     */
     uint64_t insert(persistent_ptr<T> value) {
-        auto id = getNextId();
-        if (!insertKV(id, value)) {
+        persistent_ptr<KVPair> id;
+        bool inserted = false;
+        transaction::exec_tx(pop, [&] {
+            id = getNextId();
+            inserted = id != nullptr && insertKV(id, value);
+            if (inserted)
+                _hashmapSize++;
+        }, _writeLock);
+        if (!inserted)
             return -1;
-        }
-        _hashmapSize++;
+        if (_dramIndex)
+            _dramIndex->insert(id->idValue, id.raw());
         return id->idValue;
     }
 
     bool insertKV(persistent_ptr<KVPair> &id, persistent_ptr<T> value) { //internal use
         if (_isCapped) {
             if (!hasId(id->idValue)) {
-                _list[id->idValue % _size]->insertKV_capped(id, value, _isCapped,
+                _list[bucketOf(id->idValue)]->insertKV_capped(id, value, _isCapped,
                                                    _maxDocuments, _sizeOfCollection);
             } else
                 return false;
         } else {
             if (!hasId(id->idValue)) {
-                _list[id->idValue % _size]->insertKV(id, value);
+                _list[bucketOf(id->idValue)]->insertKV(id, value);
             } else {
                 return false;
             }
@@ -102,81 +207,402 @@ public:
         return true; //correctly added
     }
 
-    bool updateKV(uint64_t id, persistent_ptr<T> value) {
-        persistent_ptr<T> temp;
-        if (find(id, temp)) {
-            _list[id % _size]->update(id, value);
-            _dataSize += pmemobj_alloc_usable_size(value.raw()) - pmemobj_alloc_usable_size(temp.raw());
-        } else {
-            return false;
-        }
-        return true;
+    /*
+     * New value becomes newest version of record. Versions which no
+     * snapshot older than oldest can see are freed. check is called with
+     * newest version under write lock, it can throw to stop the update
+     * or return false when record doesn't count as existing.
+     */
+    template<typename Check>
+    bool updateKV(uint64_t id, persistent_ptr<T> value, uint64_t oldest, Check check) {
+        bool found = false;
+        transaction::exec_tx(pop, [&] {
+            auto list = _list[bucketOf(id)];
+            persistent_ptr<KVPair> pair;
+            if (!list->getPair(id, pair))
+                return;
+            auto newest = pair->ptr;
+            if (!check(newest))
+                return;
+            list->update(id, value);
+            pruneVersions(value, oldest);
+            if (isTombstone(value.get()))
+                _tombstones++;
+            _dataSize += pmemobj_alloc_usable_size(value.raw())
+                            - pmemobj_alloc_usable_size(newest.raw());
+            found = true;
+        }, _writeLock);
+        return found;
+    }
+
+    /*
+     * Unlinks and frees newest version of record, used to undo update.
+     */
+    void dropNewestVersion(uint64_t id) {
+        persistent_ptr<KVPair> pair;
+        if (!getPair(id, pair) || pair->ptr == nullptr)
+            return;
+        transaction::exec_tx(pop, [&] {
+            auto newest = pair->ptr;
+            persistent_ptr<T> older(newest->older);
+            if (isTombstone(newest.get()))
+                _tombstones--;
+            pair->ptr = older;
+            _dataSize += pmemobj_alloc_usable_size(older.raw())
+                            - pmemobj_alloc_usable_size(newest.raw());
+            _limbo.retire(newest.raw());
+        }, _writeLock);
     }
 
     bool hasId(uint64_t id) {
-        return _list[id % _size]->hasKey(id);
+        if (_dramIndex)
+            return _dramIndex->contains(id);
+        return _list[bucketOf(id)]->hasKey(id);
     }
 
     bool find(uint64_t id, persistent_ptr<T> &value) {
-        return _list[id % _size]->find(id, value);
+        if (_dramIndex) {
+            persistent_ptr<KVPair> pair;
+            if (!getPair(id, pair)) {
+                value = nullptr;
+                return false;
+            }
+            value = pair->ptr;
+            return true;
+        }
+        return _list[bucketOf(id)]->find(id, value);
     }
 
     bool getPair(uint64_t id, persistent_ptr<KVPair> &value) {
-        return _list[id % _size]->getPair(id, value);
+        if (_dramIndex) {
+            PMEMoid oid;
+            if (!_dramIndex->find(id, oid)) {
+                value = nullptr;
+                return false;
+            }
+            value = persistent_ptr<KVPair>(oid);
+            return true;
+        }
+        return _list[bucketOf(id)]->getPair(id, value);
+    }
+
+    /*
+     * check is called with newest version under write lock, as in
+     * updateKV. DRAM index is changed after transaction commits, as on
+     * insert.
+     */
+    template<typename Check>
+    bool remove(uint64_t id, Check check) {
+        bool found = false;
+        transaction::exec_tx(pop, [&] {
+            auto list = _list[bucketOf(id)];
+            persistent_ptr<KVPair> pair;
+            if (!list->getPair(id, pair) || !check(pair->ptr))
+                return;
+            if (isTombstone(pair->ptr.get()))
+                _tombstones--;
+            _dataSize -= list->deleteKV(id, _limbo);
+            _hashmapSize--;
+            found = true;
+        }, _writeLock);
+        if (found && _dramIndex)
+            _dramIndex->remove(id);
+        return found;
     }
 
     bool remove(uint64_t id) {
-        _list[id % _size]->deleteKV(id, _deleted);
-        _hashmapSize--;
-        return true;
+        return remove(id, [](persistent_ptr<T>) { return true; });
+    }
+
+    /*
+     * Unlinks records deleted before restart, no snapshot can see
+     * their older versions. Must be called before index is attached.
+     */
+    void removeTombstones() {
+        if (_tombstones == 0)
+            return;
+        std::vector<uint64_t> ids;
+        for (int i = 0; i < _size; i++) {
+            for (auto rec = _list[i]->head; rec != nullptr; rec = rec->next) {
+                if (isTombstone(rec->ptr.get()))
+                    ids.push_back(rec->idValue);
+            }
+        }
+        for (auto id : ids)
+            remove(id);
     }
 
+    /*
+     * Buckets are touched only on first run, opening existing map
+     * doesn't walk the bucket directory. Volatile members are reset on
+     * every open, DRAM index is attached afterwards.
+     */
     void initialize(bool firstRun) {
         pop = pool_by_vptr(this);
+        _dramIndex = nullptr;
+        if (!firstRun)
+            return;
         for(int i = 0; i < _size; i++) {
-            if (firstRun) {
-                try {
-                    _list[i] = make_persistent<PmseListIntPtr>();
-                } catch(std::exception &e) {
-                    std::cout << e.what() << std::endl;
+            try {
+                _list[i] = make_persistent<PmseListIntPtr>();
+            } catch(std::exception &e) {
+                std::cout << e.what() << std::endl;
+            }
+        }
+    }
+
+    /*
+     * Attach volatile index (or detach with nullptr). Index is filled
+     * from bucket lists, buckets are split between worker threads.
+     */
+    void attachIndex(PmseDramIndex* index) {
+        _dramIndex = index;
+        if (!index)
+            return;
+        index->clear();
+        index->reserve(_hashmapSize);
+        parallelForRanges(_size, pmseWorkerThreads(),
+                          [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++) {
+                for (auto rec = _list[i]->head; rec != nullptr; rec = rec->next) {
+                    index->insert(rec->idValue, rec.raw());
+                }
+            }
+        });
+    }
+
+    uint64_t bucketCount() const {
+        return _size;
+    }
+
+    uint64_t stride() const {
+        return _stride;
+    }
+
+    uint64_t offset() const {
+        return _offset;
+    }
+
+    template<typename F>
+    void forEachInBucket(uint64_t bucket, F fn) {
+        for (auto rec = _list[bucket]->head; rec != nullptr; rec = rec->next) {
+            fn(rec);
+        }
+    }
+
+    /*
+     * Check bucket chains in [begin, end): cycles, pointers to other pools,
+     * placement of ids and agreement with per-bucket sizes.
+     * fn is called for every record with valid data pointer.
+     */
+    template<typename F>
+    void validateBuckets(uint64_t begin, uint64_t end, PmseBucketCheck &check, F fn) {
+        PMEMobjpool* pm_pool = pmemobj_pool_by_ptr(this);
+        uint64_t maxSteps = _hashmapSize + 1;
+        for (uint64_t i = begin; i < end; i++) {
+            auto list = _list[i];
+            std::string bucket = "bucket " + std::to_string(i) + ": ";
+            if (list == nullptr || pmemobj_pool_by_oid(list.raw()) != pm_pool) {
+                check.addError(bucket + "dangling list pointer");
+                continue;
+            }
+            uint64_t steps = 0;
+            persistent_ptr<KVPair> last = nullptr;
+            for (auto rec = list->head; rec != nullptr; rec = rec->next) {
+                if (pmemobj_pool_by_oid(rec.raw()) != pm_pool) {
+                    check.addError(bucket + "dangling record pointer");
+                    break;
+                }
+                if (++steps > maxSteps) {
+                    check.addError(bucket + "cycle in record chain");
+                    break;
+                }
+                last = rec;
+                uint64_t id = rec->idValue;
+                if (!_isCapped && (bucketOf(id) != i || id % _stride != _offset)) {
+                    check.addError(bucket + "record " + std::to_string(id)
+                                   + " placed in wrong bucket");
+                }
+                auto value = rec->ptr;
+                if (value == nullptr || pmemobj_pool_by_oid(value.raw()) != pm_pool) {
+                    check.addError(bucket + "record " + std::to_string(id)
+                                   + " has dangling data pointer");
+                    continue;
+                }
+                uint64_t usable = pmemobj_alloc_usable_size(value.raw());
+                if (usable < sizeof(T) + value->size) {
+                    check.addError(bucket + "record " + std::to_string(id)
+                                   + " is bigger than its allocation");
+                    continue;
+                }
+                check.dataSize += usable;
+                if (isTombstone(value.get()))
+                    continue;
+                check.records++;
+                fn(rec);
+            }
+            if (steps <= maxSteps && last != list->tail && list->head != nullptr) {
+                check.addError(bucket + "tail does not point to last record");
+            }
+            if (steps <= maxSteps && steps != list->_size) {
+                check.addError(bucket + "has " + std::to_string(steps)
+                               + " records, expected " + std::to_string(list->_size));
+            }
+        }
+    }
+
+    /*
+     * Moves records of bucket into new allocations, at most maxObjects
+     * records per transaction, so allocator can fill holes left by
+     * earlier frees. Old records and pairs go to limbo, readers may still
+     * hold them. Returns number of bytes given back once they are freed.
+     */
+    int64_t compactBucket(uint64_t bucket, uint64_t maxObjects) {
+        int64_t reclaimed = 0;
+        auto list = _list[bucket];
+        persistent_ptr<KVPair> prev = nullptr;
+        persistent_ptr<KVPair> rec = list->head;
+        while (rec != nullptr) {
+            std::vector<std::pair<uint64_t, PMEMoid>> moved;
+            transaction::exec_tx(pool_by_vptr(this), [&] {
+                for (uint64_t n = 0; rec != nullptr && n < maxObjects; n++) {
+                    auto oldData = rec->ptr;
+                    size_t length = sizeof(T) + oldData->size;
+                    int64_t oldUsable = pmemobj_alloc_usable_size(oldData.raw());
+
+                    persistent_ptr<T> newData = pmemobj_tx_alloc(length, 1);
+                    memcpy(newData.get(), oldData.get(), length);
+                    auto newPair = make_persistent<KVPair>();
+                    newPair->idValue = rec->idValue;
+                    newPair->ptr = newData;
+                    newPair->next = rec->next;
+
+                    if (prev == nullptr)
+                        list->head = newPair;
+                    else
+                        prev->next = newPair;
+                    if (list->tail == rec)
+                        list->tail = newPair;
+
+                    int64_t newUsable = pmemobj_alloc_usable_size(newData.raw());
+                    reclaimed += oldUsable - newUsable
+                                    + pmemobj_alloc_usable_size(rec.raw())
+                                    - pmemobj_alloc_usable_size(newPair.raw());
+                    _dataSize += newUsable - oldUsable;
+
+                    auto next = rec->next;
+                    _limbo.retire(oldData.raw());
+                    _limbo.retire(rec.raw());
+                    moved.emplace_back(newPair->idValue, newPair.raw());
+                    prev = newPair;
+                    rec = next;
                 }
+            }, _writeLock);
+            if (_dramIndex) {
+                for (auto &entry : moved)
+                    _dramIndex->insert(entry.first, entry.second);
             }
-            _list[i]->setPool();
         }
+        return reclaimed;
+    }
+
+    /*
+     * Prefault bucket array and list headers.
+     */
+    void prefaultBuckets() {
+        prefaultObject(_list.get(), _size * sizeof(persistent_ptr<PmseListIntPtr>));
+        parallelForRanges(_size, pmseWorkerThreads(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++) {
+                auto list = _list[i];
+                if (list != nullptr)
+                    prefaultObject(list.get(), sizeof(PmseListIntPtr));
+            }
+        });
     }
 
     void deinitialize() {
         //TODO: deallocate all resources
     }
 
+    /* Records deleted but not unlinked yet are not counted */
     uint64_t fillment() {
         if(_isCapped)
-            return _list[0]->size();
-        return _hashmapSize;
+            return _list[0]->size() - _tombstones;
+        return _hashmapSize - _tombstones;
     }
 
-    bool truncate() {
-        bool status = true;
-        try {
-            transaction::exec_tx(pop, [&] {
-                for(int i = 0; i < _size; i++) {
-                    _list[i]->clear();
-                    delete_persistent<PmseListIntPtr>(_list[i]);
+    /*
+     * Readers which found map before truncate unlinked it may walk it
+     * until epoch moves two steps past the epoch it was retired in.
+     * Epochs restart on open, so it's reset to 0 then.
+     */
+    void setRetiredEpoch(uint64_t epoch) {
+        _retiredEpoch = epoch;
+    }
+
+    bool reclaimable(uint64_t current) const {
+        return PmseEpochManager::reclaimable(_retiredEpoch, current);
+    }
+
+    /*
+     * Frees at most maxObjects objects of retired map in one transaction.
+     * Progress is kept in the map itself, so it can be resumed after restart.
+     * Returns true when only the map object is left, false also when
+     * readers may still reference the map.
+     */
+    bool reclaim(uint64_t maxObjects) {
+        uint64_t current = PmseEpochManager::get().current();
+        if (!reclaimable(current))
+            return false;
+        uint64_t freed = 0;
+        bool done = false;
+        transaction::exec_tx(pool_by_vptr(this), [&] {
+            /* Everything in limbo was retired before the map */
+            freed += _limbo.release(pool_by_vptr(this), current, maxObjects);
+            if (_list == nullptr) {
+                done = true;
+                return;
+            }
+            for (int i = 0; i < _size && freed < maxObjects; i++) {
+                auto list = _list[i];
+                if (list == nullptr)
+                    continue;
+                while (list->head != nullptr && freed < maxObjects) {
+                    auto rec = list->head;
+                    list->head = rec->next;
+                    if (rec->ptr != nullptr)
+                        deleteVersions(rec->ptr);
+                    delete_persistent<KVPair>(rec);
+                    freed++;
                 }
-                initialize(true);
-            });
-            _counter = 0;
-            _hashmapSize = 0;
-            _counterCapped = 0;
-            _dataSize = 0;
-        } catch (nvml::transaction_alloc_error &e) {
-            std::cout << e.what() << std::endl;
-            status = false;
-        } catch (nvml::transaction_scope_error &e) {
-            std::cout << e.what() << std::endl;
-            status = false;
-        }
-        return status;
+                if (list->head == nullptr) {
+                    delete_persistent<PmseListIntPtr>(list);
+                    _list[i] = nullptr;
+                    freed++;
+                }
+            }
+            if (freed < maxObjects) {
+                delete_persistent<persistent_ptr<PmseListIntPtr>[]>(_list, _size);
+                _list = nullptr;
+                done = true;
+            }
+        });
+        return done;
+    }
+
+    /*
+     * Frees deleted and replaced records no reader can reference.
+     */
+    uint64_t releaseRetired(uint64_t epoch, uint64_t maxObjects) {
+        return _limbo.release(pool_by_vptr(this), epoch, maxObjects);
+    }
+
+    persistent_ptr<PmseMap<T>> nextRetired() {
+        return _nextRetired;
+    }
+
+    void setNextRetired(persistent_ptr<PmseMap<T>> next) {
+        _nextRetired = next;
     }
 
     int64_t dataSize() {
@@ -201,11 +627,36 @@ private:
     p<int64_t> _dataSize = 0;
     p<uint64_t> _counter = 0;
     p<uint64_t> _hashmapSize = 0;
+    p<uint64_t> _tombstones = 0;
     p<uint64_t> _maxDocuments;
     p<uint64_t> _sizeOfCollection;
     p<uint64_t> _counterCapped = 0;
+    p<uint64_t> _stride = 1;
+    p<uint64_t> _offset = 0;
     persistent_ptr<persistent_ptr<PmseListIntPtr>[]> _list;
-    persistent_ptr<KVPair> _deleted;
+    persistent_ptr<PmseMap<T>> _nextRetired;
+    p<uint64_t> _retiredEpoch = 0;
+    /*
+     * Serializes id allocation, bucket links and map counters. Taken
+     * before lock of limbo.
+     */
+    nvml::obj::mutex _writeLock;
+    PmseLimbo _limbo;
+    /* Volatile, holds address from previous run until initialize() */
+    PmseDramIndex* _dramIndex = nullptr;
+
+    /* Ids of stripe are offset + n * stride, consecutive n share no bucket */
+    uint64_t idOf(uint64_t n) const {
+        return n * _stride + _offset;
+    }
+
+    uint64_t bucketOf(uint64_t id) const {
+        return (id / _stride) % _size;
+    }
+
+    bool idsExhausted() const {
+        return _counter + 1 > (std::numeric_limits<uint64_t>::max() - 1 - _offset) / _stride;
+    }
 
     persistent_ptr<KVPair> getFirstPtr(int listNumber) {
         if (listNumber < _size)
@@ -213,28 +664,24 @@ private:
         return {};
     }
 
+    /*
+     * Ids of removed records are not reused, their pairs can be read
+     * until limbo frees them.
+     */
     persistent_ptr<KVPair> getNextId() {
         persistent_ptr<KVPair> temp = nullptr;
-        if(_deleted == nullptr) {
-            if(_counter != std::numeric_limits<uint64_t>::max()-1) {
-                this->_counter++;
-                try {
-                    transaction::exec_tx(pop, [&] {
-                        temp = make_persistent<KVPair>();
-                        temp->idValue = _counter;
-                    });
-                } catch (std::exception &e) {
-                    std::cout << "Next id generation: " << e.what() << std::endl;
-                }
-            } else {
-                return nullptr;
+        if(!idsExhausted()) {
+            this->_counter++;
+            try {
+                transaction::exec_tx(pop, [&] {
+                    temp = make_persistent<KVPair>();
+                    temp->idValue = idOf(_counter);
+                });
+            } catch (std::exception &e) {
+                std::cout << "Next id generation: " << e.what() << std::endl;
             }
         } else {
-            temp = _deleted;
-            uint64_t id = 0;
-            id = _deleted->idValue;
-            _deleted = _deleted->next;
-            return temp;
+            return nullptr;
         }
         return temp;
     }
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define MONGO_LOG_DEFAULT_COMPONENT ::mongo::logger::LogComponent::kStorage
+
+#include "mongo/platform/basic.h"
+#include "mongo/util/log.h"
+
+#include "pmse_checksum.h"
+#include "pmse_global_options.h"
+#include "pmse_numa.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+namespace mongo {
+
+int pmseNumaNodeFor(StringData ns) {
+    const auto& paths = pmseGlobalOptions.numaPaths;
+    if (paths.empty())
+        return -1;
+    /* Stable hash, placement must not change between runs */
+    return crc32c(ns.rawData(), ns.size()) % paths.size();
+}
+
+namespace {
+bool findExisting(const std::string& dbpath, const std::string& filename,
+                  std::string* path) {
+    for (const auto& dir : pmsePoolDirs(dbpath)) {
+        if (boost::filesystem::exists(dir + filename)) {
+            *path = dir + filename;
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+std::string pmsePoolPath(const std::string& dbpath, const std::string& filename,
+                         StringData ns) {
+    std::string path;
+    if (findExisting(dbpath, filename, &path))
+        return path;
+    int node = pmseNumaNodeFor(ns);
+    if (node < 0)
+        return dbpath + filename;
+    return pmseGlobalOptions.numaPaths[node] + filename;
+}
+
+std::string pmseStripePath(const std::string& dbpath, const std::string& filename,
+                           uint64_t stripe) {
+    std::string path;
+    if (findExisting(dbpath, filename, &path))
+        return path;
+    const auto& paths = pmseGlobalOptions.stripePaths;
+    if (paths.empty())
+        return dbpath + filename;
+    return paths[stripe % paths.size()] + filename;
+}
+
+std::vector<std::string> pmsePoolDirs(const std::string& dbpath) {
+    std::vector<std::string> dirs = pmseGlobalOptions.numaPaths;
+    dirs.insert(dirs.end(), pmseGlobalOptions.stripePaths.begin(),
+                pmseGlobalOptions.stripePaths.end());
+    dirs.push_back(dbpath);
+    return dirs;
+}
+
+int pmseNodeOfPath(const std::string& path) {
+    const auto& paths = pmseGlobalOptions.numaPaths;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (path.compare(0, paths[i].size(), paths[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void pmseAppendNumaStats(BSONObjBuilder* builder) {
+    const auto& paths = pmseGlobalOptions.numaPaths;
+    BSONObjBuilder numa(builder->subobjStart("numa"));
+    numa.appendNumber("nodes", static_cast<long long>(paths.size()));
+    BSONArrayBuilder dirs(numa.subarrayStart("paths"));
+    for (const auto& path : paths)
+        dirs.append(path);
+    dirs.done();
+    numa.done();
+}
+
+namespace {
+/*
+ * Parses cpulist of node from sysfs, e.g. "0-13,28-41".
+ */
+bool nodeCpus(int node, cpu_set_t* set) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!std::getline(file, list))
+        return false;
+    CPU_ZERO(set);
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty())
+            continue;
+        auto dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+    }
+    return CPU_COUNT(set) > 0;
+}
+}
+
+PmseNodeBinding::PmseNodeBinding(int node) {
+    if (node < 0)
+        return;
+    cpu_set_t set;
+    if (!nodeCpus(node, &set))
+        return;
+    if (sched_getaffinity(0, sizeof(_previous), &_previous) != 0)
+        return;
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        log() << "Can't bind thread to NUMA node " << node;
+        return;
+    }
+    _bound = true;
+}
+
+PmseNodeBinding::~PmseNodeBinding() {
+    if (_bound)
+        sched_setaffinity(0, sizeof(_previous), &_previous);
+}
+
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_NUMA_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_NUMA_H_
+
+#include <sched.h>
+
+#include <string>
+#include <vector>
+
+#include "mongo/base/string_data.h"
+#include "mongo/bson/bsonobjbuilder.h"
+
+namespace mongo {
+
+/*
+ * Pools of collection and its indexes are placed on one NUMA node,
+ * chosen by hash of collection namespace, in directory given for that
+ * node by numaPaths option. Without numaPaths everything stays in dbpath.
+ */
+int pmseNumaNodeFor(StringData ns);
+
+/*
+ * Full path of pool file. Existing file is looked up in all node
+ * directories first, so placement survives changes of node count.
+ */
+std::string pmsePoolPath(const std::string& dbpath, const std::string& filename,
+                         StringData ns);
+
+/*
+ * Full path of pool file of given stripe, new stripes are placed
+ * round robin in directories given by stripePaths option.
+ */
+std::string pmseStripePath(const std::string& dbpath, const std::string& filename,
+                           uint64_t stripe);
+
+/* All directories which may contain pool files */
+std::vector<std::string> pmsePoolDirs(const std::string& dbpath);
+
+/* Node of directory holding given pool file, -1 for dbpath */
+int pmseNodeOfPath(const std::string& path);
+
+void pmseAppendNumaStats(BSONObjBuilder* builder);
+
+/*
+ * Binds current thread to CPUs of node, threads it starts inherit
+ * the binding. Previous binding is restored in destructor.
+ */
+class PmseNodeBinding {
+public:
+    explicit PmseNodeBinding(int node);
+    ~PmseNodeBinding();
+
+private:
+    bool _bound = false;
+    cpu_set_t _previous;
+};
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_NUMA_H_ */
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_PARALLEL_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_PARALLEL_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "mongo/stdx/thread.h"
+
+#include "pmse_global_options.h"
+
+namespace mongo {
+
+inline uint64_t pmseWorkerThreads() {
+    if (pmseGlobalOptions.workerThreads > 0)
+        return pmseGlobalOptions.workerThreads;
+    uint64_t hw = stdx::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+/*
+ * Splits [0, count) into contiguous ranges and calls fn(begin, end)
+ * for each of them on separate thread. Returns when all ranges are done.
+ */
+template<typename F>
+void parallelForRanges(uint64_t count, uint64_t threads, F fn) {
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        fn(uint64_t(0), count);
+        return;
+    }
+    std::vector<stdx::thread> workers;
+    uint64_t chunk = (count + threads - 1) / threads;
+    for (uint64_t begin = 0; begin < count; begin += chunk) {
+        uint64_t end = std::min(begin + chunk, count);
+        workers.emplace_back([&fn, begin, end] {
+            fn(begin, end);
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_PARALLEL_H_ */
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mongo/platform/basic.h"
+
+#include "pmse_parallel.h"
+#include "pmse_prefault.h"
+
+#include <atomic>
+
+#include <boost/filesystem.hpp>
+
+namespace mongo {
+
+uint64_t prefaultRange(const void* addr, size_t len) {
+    auto base = static_cast<const volatile char*>(addr);
+    uint64_t pages = (len + PREFAULT_PAGE_SIZE - 1) / PREFAULT_PAGE_SIZE;
+    std::atomic<uint64_t> sink{0};
+    parallelForRanges(pages, pmseWorkerThreads(), [&](uint64_t begin, uint64_t end) {
+        uint64_t sum = 0;
+        for (uint64_t i = begin; i < end; i++)
+            sum += base[i * PREFAULT_PAGE_SIZE];
+        sink += sum;
+    });
+    return pages;
+}
+
+uint64_t prefaultPool(PMEMobjpool* pm_pool, const std::string& filename) {
+    boost::system::error_code ec;
+    uint64_t size = boost::filesystem::file_size(filename, ec);
+    if (ec || pm_pool == nullptr)
+        return 0;
+    return prefaultRange(pm_pool, size);
+}
+
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_PREFAULT_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_PREFAULT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <libpmemobj.h>
+
+namespace mongo {
+
+const size_t PREFAULT_PAGE_SIZE = 4096;
+
+/*
+ * Read one byte of every page of small object on calling thread.
+ */
+inline uint64_t prefaultObject(const void* addr, size_t len) {
+    auto p = static_cast<const volatile char*>(addr);
+    uint64_t sum = 0;
+    for (size_t off = 0; off < len; off += PREFAULT_PAGE_SIZE)
+        sum += p[off];
+    sum += p[len - 1];
+    return sum;
+}
+
+/*
+ * Read one byte of every page of range, pages are split between worker threads.
+ * Returns number of touched pages.
+ */
+uint64_t prefaultRange(const void* addr, size_t len);
+
+/*
+ * Prefault whole mapping of pool stored in given file.
+ */
+uint64_t prefaultPool(PMEMobjpool* pm_pool, const std::string& filename);
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_PREFAULT_H_ */
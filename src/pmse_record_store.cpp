@@ -32,13 +32,28 @@
 
 #define MONGO_LOG_DEFAULT_COMPONENT ::mongo::logger::LogComponent::kStorage
 
+#include "mongo/db/concurrency/write_conflict_exception.h"
+#include "mongo/db/operation_context.h"
 #include "mongo/db/storage/record_store.h"
+#include "mongo/stdx/chrono.h"
 #include "mongo/util/log.h"
+#include "mongo/util/mongoutils/str.h"
+#include "mongo/util/scopeguard.h"
+#include "mongo/util/timer.h"
 
+#include "pmse_checksum.h"
+#include "pmse_epoch.h"
+#include "pmse_global_options.h"
+#include "pmse_numa.h"
+#include "pmse_parallel.h"
+#include "pmse_prefault.h"
 #include "pmse_record_store.h"
+#include "pmse_recovery_unit.h"
+#include "pmse_snapshot.h"
 
 #include "errno.h"
 
+#include <algorithm>
 #include <cstdlib>
 
 #include <libpmemobj++/transaction.hpp>
@@ -51,112 +66,583 @@ using nvml::obj::transaction;
 
 namespace mongo {
 
+namespace {
+/*
+ * Layout of collection pools, changed whenever PmseMap, bucket lists or
+ * records change their persistent format. Pools of other layouts are
+ * refused, collection has to be rebuilt (e.g. by dump and restore).
+ */
+const char* const mapperLayout = "kvmapper_v2";
+
+/*
+ * Fills record, big documents are copied with non-temporal stores so
+ * they don't evict cache. Record is flushed but not drained, caller
+ * drains once per operation (transaction commit drains too).
+ */
+void fillRecord(PMEMobjpool* pop, InitData* obj, const char* data, int len,
+                uint64_t stamp) {
+    obj->size = len;
+    obj->stamp = stamp;
+    obj->older = OID_NULL;
+    unsigned flags = PMEMOBJ_F_MEM_NODRAIN;
+    flags |= len >= NT_COPY_THRESHOLD ? PMEMOBJ_F_MEM_NONTEMPORAL : PMEMOBJ_F_MEM_TEMPORAL;
+    pmemobj_memcpy(pop, obj->data, data, len, flags);
+    setChecksum(obj, data, pmseGlobalOptions.recordChecksums);
+    pmemobj_flush(pop, obj, sizeof(InitData));
+}
+
+void verifyRecord(const InitData* obj, uint64_t id) {
+    if (checksumMatches(obj))
+        return;
+    pmseChecksumStats.readFailures++;
+    error() << "Checksum mismatch for record " << id;
+    uasserted(ErrorCodes::InternalError,
+              str::stream() << "Record " << id << " failed checksum verification");
+}
+}
+
 PmseRecordStore::PmseRecordStore(StringData ns,
                                        const CollectionOptions& options,
-                                       StringData dbpath) :
-                RecordStore(ns), _cappedCallback(nullptr), _options(options), _DBPATH(dbpath) {
+                                       StringData dbpath, const std::string& dbDir) :
+                RecordStore(ns), _cappedCallback(nullptr), _options(options), _DBPATH(dbpath),
+                _dbDir(dbDir) {
     log() << "ns: " << ns;
     _numInserts = 0;
-    std::string filename = _DBPATH.toString() + ns.toString();
-    boost::filesystem::path path;
-    log() << filename;
+    std::string filename = _dbDir + ns.toString() + "_mapper";
+    if (!options.capped && !pmseGlobalOptions.stripePaths.empty())
+        _mapperFilename = pmseStripePath(_DBPATH.toString(), filename, 0);
+    else
+        _mapperFilename = pmsePoolPath(_DBPATH.toString(), filename, ns);
+    _numaNode = pmseNodeOfPath(_mapperFilename);
+    log() << _mapperFilename;
     if (ns.toString() == "local.startup_log"
-                    && boost::filesystem::exists(filename)) {
+                    && boost::filesystem::exists(_mapperFilename)) {
         log() << "Delete old startup log";
-        boost::filesystem::remove_all(filename);
-        boost::filesystem::remove_all(filename + "_mapper");
+        boost::filesystem::remove_all(_mapperFilename);
     }
 
-    std::string mapper_filename = _DBPATH.toString() + ns.toString()
-                    + "_mapper";
+    PmseScrubber::get().registerStore(this);
+    if (pmseGlobalOptions.touchOnStartup != kTouchNone) {
+        _ensureOpen();
+    }
+}
+
+/*
+ * Pool is opened on first real access, until then record store
+ * keeps only names and options.
+ */
+void PmseRecordStore::_ensureOpen() const {
+    if (_opened.load(std::memory_order_acquire))
+        return;
+    stdx::lock_guard<stdx::mutex> lock(_openMutex);
+    if (_opened.load(std::memory_order_relaxed))
+        return;
+    // Opening doesn't change logical state of record store
+    const_cast<PmseRecordStore*>(this)->_open();
+    _opened.store(true, std::memory_order_release);
+}
+
+void PmseRecordStore::_openPool(PmseStripe& stripe) {
+    const std::string& mapper_filename = stripe.filename;
     if (!boost::filesystem::exists(mapper_filename.c_str())) {
         std::cout << "Mapper create pool..." << std::endl;
-        mapPool = pool<root>::create(mapper_filename, "kvmapper",
-                                     (ns.toString() == "local.startup_log" ||
-                                      ns.toString() == "_mdb_catalog" ? 10 : 80)
-                                     * PMEMOBJ_MIN_POOL);
+        boost::filesystem::create_directories(
+                        boost::filesystem::path(mapper_filename).parent_path());
+        stripe.mapPool = pool<root>::create(mapper_filename, mapperLayout,
+                                            (ns() == "local.startup_log" ||
+                                             ns() == "_mdb_catalog" ? 10 : 80)
+                                            * PMEMOBJ_MIN_POOL);
         std::cout << "Create pool end" << std::endl;
     } else {
         std::cout << "Open pool..." << std::endl;
         try {
-            mapPool = pool<root>::open(mapper_filename, "kvmapper");
+            stripe.mapPool = pool<root>::open(mapper_filename, mapperLayout);
         } catch (std::exception &e) {
-            std::cout << "Error handled: " << e.what() << std::endl;
+            error() << "Can't open " << mapper_filename << ": " << e.what();
+            uasserted(ErrorCodes::InternalError,
+                      str::stream() << "Pool " << mapper_filename << " can't be opened,"
+                                    << " pools created by older versions have to be rebuilt");
         }
         std::cout << "Open pool end..." << std::endl;
     }
-    auto mapper_root = mapPool.get_root();
+}
 
-    if (!mapper_root->kvmap_root_ptr) {
-        transaction::exec_tx(mapPool,[&] {
-            mapper_root->kvmap_root_ptr = make_persistent<PmseMap<InitData>>(options.capped, options.cappedMaxDocs, options.cappedSize);
-            mapper_root->kvmap_root_ptr->initialize(true);
+/*
+ * Must be called inside transaction on pool of the stripe.
+ */
+persistent_ptr<PmseMap<InitData>> PmseRecordStore::_newMap(uint64_t stripe) {
+    auto map = make_persistent<PmseMap<InitData>>(_options.capped, _options.cappedMaxDocs,
+                                                  _options.cappedSize, HASHMAP_SIZE,
+                                                  _stripes.size(), stripe);
+    map->initialize(true);
+    return map;
+}
+
+/*
+ * Stripe count is chosen when collection is created and kept in
+ * pool of first stripe, other stripes are opened after it.
+ */
+void PmseRecordStore::_open() {
+    /* Index rebuild and prefault threads run on node of the pool */
+    PmseNodeBinding binding(_numaNode);
+    _stripes.resize(1);
+    _stripes[0].filename = _mapperFilename;
+    _openPool(_stripes[0]);
+    auto first_root = _stripes[0].mapPool.get_root();
+    if (!first_root->kvmap_root_ptr) {
+        uint64_t count = _options.capped ? 1 : pmseGlobalOptions.stripePaths.size();
+        transaction::exec_tx(_stripes[0].mapPool, [&] {
+            first_root->stripeCount = std::max<uint64_t>(count, 1);
         });
-    } else {
-        transaction::exec_tx(mapPool,[&] {
+    }
+    /* Pools created before striping have no count */
+    uint64_t count = std::max<uint64_t>(first_root->stripeCount, 1);
+    _stripes.resize(count);
+    for (uint64_t i = 1; i < count; i++) {
+        _stripes[i].filename = pmseStripePath(_DBPATH.toString(),
+                                              _dbDir + ns().toString() + "_mapper."
+                                              + std::to_string(i),
+                                              i);
+        if (first_root->kvmap_root_ptr && !boost::filesystem::exists(_stripes[i].filename))
+            error() << "Stripe " << i << " of " << ns() << " is missing, creating empty one";
+        _openPool(_stripes[i]);
+    }
+
+    bool retired = false;
+    for (uint64_t i = 0; i < count; i++) {
+        auto& stripe = _stripes[i];
+        auto mapper_root = stripe.mapPool.get_root();
+        if (!mapper_root->kvmap_root_ptr) {
+            transaction::exec_tx(stripe.mapPool, [&] {
+                mapper_root->kvmap_root_ptr = _newMap(i);
+            });
+        } else {
             mapper_root->kvmap_root_ptr->initialize(false);
-        });
+        }
+        stripe.mapper = mapper_root->kvmap_root_ptr;
+        if (pmseGlobalOptions.hybridIndex && !_options.capped) {
+            stripe.dramIndex = stdx::make_unique<PmseDramIndex>();
+        }
+        stripe.mapper->removeTombstones();
+        /* Nothing can reference records retired before restart */
+        while (stripe.mapper->releaseRetired(~0ULL, RELEASE_BATCH_SIZE) > 0) {}
+        stripe.mapper->attachIndex(stripe.dramIndex.get());
+        if (stripe.dramIndex) {
+            log() << "Rebuilt DRAM index: " << stripe.dramIndex->size() << " records";
+        }
+        if (mapper_root->kvmap_retired_ptr != nullptr) {
+            retired = true;
+            /* Epochs restart, no reader of previous run is left */
+            transaction::exec_tx(stripe.mapPool, [&] {
+                for (auto map = mapper_root->kvmap_retired_ptr; map != nullptr;
+                     map = map->nextRetired())
+                    map->setRetiredEpoch(0);
+            });
+        }
+        if (pmseGlobalOptions.touchOnStartup == kTouchFull) {
+            prefaultPool(stripe.mapPool.get_handle(), stripe.filename);
+        } else if (pmseGlobalOptions.touchOnStartup == kTouchMetadata) {
+            stripe.mapper->prefaultBuckets();
+        }
+    }
+    if (retired) {
+        _startReclaim();
+    }
+}
+
+Status PmseRecordStore::touch(OperationContext* txn, BSONObjBuilder* output) const {
+    _ensureOpen();
+    PmseNodeBinding binding(_numaNode);
+    Timer t;
+    uint64_t pages = 0;
+    for (const auto& stripe : _stripes) {
+        pages += prefaultPool(pmemobj_pool_by_ptr(stripe.mapper.get()), stripe.filename);
+    }
+    if (output) {
+        output->appendNumber("numPages", static_cast<long long>(pages));
+        output->append("millis", t.millis());
     }
+    return Status::OK();
+}
+
+int64_t PmseRecordStore::_dataSize() const {
+    int64_t size = 0;
+    for (const auto& stripe : _stripes)
+        size += stripe.mapper->dataSize();
+    return size;
+}
+
+/*
+ * Swap in empty map and leave freeing of old one to background thread.
+ * Each stripe is swapped in its own transaction.
+ */
+Status PmseRecordStore::truncate(OperationContext* txn) {
+    _ensureOpen();
+    try {
+        stdx::lock_guard<stdx::mutex> lock(_reclaimMutex);
+        for (uint64_t i = 0; i < _stripes.size(); i++) {
+            auto& stripe = _stripes[i];
+            auto mapper_root = stripe.mapPool.get_root();
+            /* Index of stripe is cleared for fresh map, retired one falls back to lists */
+            stripe.mapper->attachIndex(nullptr);
+            auto retired = stripe.mapper;
+            transaction::exec_tx(stripe.mapPool, [&] {
+                auto fresh = _newMap(i);
+                retired->setNextRetired(mapper_root->kvmap_retired_ptr);
+                mapper_root->kvmap_retired_ptr = retired;
+                mapper_root->kvmap_root_ptr = fresh;
+            });
+            stripe.mapper = mapper_root->kvmap_root_ptr;
+            /*
+             * Epoch is taken once new map is published, reclaim thread
+             * can't see retired map before, it waits for reclaim mutex.
+             */
+            transaction::exec_tx(stripe.mapPool, [&] {
+                retired->setRetiredEpoch(PmseEpochManager::get().current());
+            });
+            stripe.mapper->attachIndex(stripe.dramIndex.get());
+        }
+    } catch (std::exception &e) {
+        std::cout << e.what() << std::endl;
+        return Status(ErrorCodes::OperationFailed, "Truncate error");
+    }
+    _storageSize = baseSize;
+    _startReclaim();
+    return Status::OK();
+}
+
+void PmseRecordStore::_startReclaim() {
+    stdx::lock_guard<stdx::mutex> lock(_reclaimMutex);
+    if (_reclaimRunning)
+        return;
+    if (_reclaimThread.joinable())
+        _reclaimThread.join();
+    _reclaimRunning = true;
+    _reclaimThread = stdx::thread([this] { _reclaimRetired(); });
+}
+
+void PmseRecordStore::_stopReclaim() {
+    _reclaimShutdown = true;
+    if (_reclaimThread.joinable())
+        _reclaimThread.join();
+}
+
+/*
+ * Frees retired maps in bounded transactions. Work left at shutdown
+ * is resumed when the collection is opened again.
+ */
+void PmseRecordStore::_reclaimRetired() {
+    PmseNodeBinding binding(_numaNode);
     try {
-        mapper = mapPool.get_root()->kvmap_root_ptr;
+        while (!_reclaimShutdown) {
+            PmseStripe* stripe = nullptr;
+            persistent_ptr<PmseMap<InitData>> victim;
+            {
+                stdx::lock_guard<stdx::mutex> lock(_reclaimMutex);
+                for (auto& candidate : _stripes) {
+                    victim = candidate.mapPool.get_root()->kvmap_retired_ptr;
+                    if (victim != nullptr) {
+                        stripe = &candidate;
+                        break;
+                    }
+                }
+                if (victim == nullptr) {
+                    _reclaimRunning = false;
+                    return;
+                }
+            }
+            if (!victim->reclaimable(PmseEpochManager::get().tryAdvance())) {
+                /* Readers which found map before truncate are still running */
+                stdx::this_thread::sleep_for(stdx::chrono::milliseconds(10));
+                continue;
+            }
+            if (!victim->reclaim(RECLAIM_BATCH_SIZE))
+                continue;
+            auto mapper_root = stripe->mapPool.get_root();
+            stdx::lock_guard<stdx::mutex> lock(_reclaimMutex);
+            transaction::exec_tx(stripe->mapPool, [&] {
+                if (mapper_root->kvmap_retired_ptr == victim) {
+                    mapper_root->kvmap_retired_ptr = victim->nextRetired();
+                } else {
+                    auto prev = mapper_root->kvmap_retired_ptr;
+                    while (prev->nextRetired() != victim)
+                        prev = prev->nextRetired();
+                    prev->setNextRetired(victim->nextRetired());
+                }
+                delete_persistent<PmseMap<InitData>>(victim);
+            });
+        }
+    } catch (std::exception &e) {
+        log() << "Reclamation of truncated collection stopped: " << e.what();
+    }
+    stdx::lock_guard<stdx::mutex> lock(_reclaimMutex);
+    _reclaimRunning = false;
+}
 
-    } catch (std::exception& e) {
-        std::cout << "Error while creating PMStore engine" << std::endl;
-    };
+/*
+ * Undo of record store writes, applied when unit of work is aborted.
+ * On commit versions written by unit of work get its commit stamp.
+ */
+class PmseRecordStore::InsertChange : public RecoveryUnit::Change {
+public:
+    InsertChange(PmseRecordStore* rs, PmseRecoveryUnit* ru, uint64_t id)
+        : _rs(rs), _ru(ru), _id(id), _pending(ru->pendingStamp()) {}
+
+    void commit() final {
+        _rs->_commitVersions(_id, _pending, _ru->commitStamp());
+    }
+
+    void rollback() final {
+        _rs->_stripeFor(_id).mapper->remove(_id);
+    }
+
+private:
+    PmseRecordStore* _rs;
+    PmseRecoveryUnit* _ru;
+    uint64_t _id;
+    uint64_t _pending;
+};
+
+/*
+ * Record with committed tombstone is unlinked later, once no snapshot
+ * can see its older versions.
+ */
+class PmseRecordStore::DeleteChange : public RecoveryUnit::Change {
+public:
+    DeleteChange(PmseRecordStore* rs, PmseRecoveryUnit* ru, uint64_t id)
+        : _rs(rs), _ru(ru), _id(id), _pending(ru->pendingStamp()) {}
+
+    void commit() final {
+        _rs->_commitVersions(_id, _pending, _ru->commitStamp());
+        _rs->_queuePurge(_id, _ru->commitStamp());
+    }
+
+    void rollback() final {
+        auto& stripe = _rs->_stripeFor(_id);
+        stripe.mapper->dropNewestVersion(_id);
+        _rs->_releaseRetired(stripe);
+    }
+
+private:
+    PmseRecordStore* _rs;
+    PmseRecoveryUnit* _ru;
+    uint64_t _id;
+    uint64_t _pending;
+};
+
+class PmseRecordStore::UpdateChange : public RecoveryUnit::Change {
+public:
+    UpdateChange(PmseRecordStore* rs, PmseRecoveryUnit* ru, uint64_t id)
+        : _rs(rs), _ru(ru), _id(id), _pending(ru->pendingStamp()) {}
+
+    void commit() final {
+        _rs->_commitVersions(_id, _pending, _ru->commitStamp());
+    }
+
+    void rollback() final {
+        auto& stripe = _rs->_stripeFor(_id);
+        stripe.mapper->dropNewestVersion(_id);
+        _rs->_releaseRetired(stripe);
+    }
+
+private:
+    PmseRecordStore* _rs;
+    PmseRecoveryUnit* _ru;
+    uint64_t _id;
+    uint64_t _pending;
+};
+
+/*
+ * Must be called inside transaction on pool of the stripe. Record is
+ * flushed by fillRecord, commit only drains.
+ */
+persistent_ptr<InitData> PmseRecordStore::_allocRecord(PmseStripe& stripe, const char* data,
+                                                       int len, uint64_t stamp) {
+    persistent_ptr<InitData> obj = pmemobj_tx_xalloc(sizeof(InitData) + len, 1,
+                                                     POBJ_XALLOC_NO_FLUSH);
+    fillRecord(stripe.mapPool.get_handle(), obj.get(), data, len, stamp);
+    return obj;
+}
+
+/*
+ * Same as _allocRecord, for version without data marking record as deleted.
+ */
+persistent_ptr<InitData> PmseRecordStore::_allocTombstone(PmseStripe& stripe, uint64_t stamp) {
+    auto obj = _allocRecord(stripe, "", 0, stamp);
+    obj->flags |= INIT_DATA_TOMBSTONE;
+    pmemobj_flush(stripe.mapPool.get_handle(), &obj->flags, sizeof(obj->flags));
+    return obj;
+}
+
+void PmseRecordStore::_queuePurge(uint64_t id, uint64_t stamp) {
+    stdx::lock_guard<stdx::mutex> lock(_purgeMutex);
+    _purgeQueue.emplace_back(stamp, id);
 }
 
+/*
+ * Unlinks records whose tombstone is visible to every snapshot, at most
+ * RELEASE_BATCH_SIZE per call. Record is left when its newest version
+ * is no longer committed tombstone.
+ */
+void PmseRecordStore::_purgeDeleted() {
+    std::vector<uint64_t> ids;
+    {
+        uint64_t oldest = PmseSnapshotManager::get().oldestActive();
+        stdx::lock_guard<stdx::mutex> lock(_purgeMutex);
+        while (!_purgeQueue.empty() && ids.size() < RELEASE_BATCH_SIZE
+               && _purgeQueue.front().first <= oldest) {
+            ids.push_back(_purgeQueue.front().second);
+            _purgeQueue.pop_front();
+        }
+    }
+    for (auto id : ids) {
+        _stripeFor(id).mapper->remove(id, [](persistent_ptr<InitData> newest) {
+            return isTombstone(newest.get()) && !(newest->stamp & STAMP_PENDING);
+        });
+    }
+}
+
+void PmseRecordStore::_releaseRetired(PmseStripe& stripe) {
+    stripe.mapper->releaseRetired(PmseEpochManager::get().tryAdvance(), RELEASE_BATCH_SIZE);
+}
+
+void PmseRecordStore::_commitVersions(uint64_t id, uint64_t pending, uint64_t stamp) {
+    persistent_ptr<InitData> obj;
+    if (_stripeFor(id).mapper->find(id, obj))
+        commitVersions(obj, pending, stamp);
+}
+
+/*
+ * Record written by unit of work which isn't committed yet can't be
+ * changed by other units. Version committed after snapshot of writer
+ * was taken can't be overwritten either, first committer wins.
+ * Called under write lock of the map, with its newest version.
+ */
+void PmseRecordStore::_checkWriteConflict(PmseRecoveryUnit* ru,
+                                          persistent_ptr<InitData> obj) const {
+    uint64_t stamp = obj->stamp;
+    if (stamp & STAMP_PENDING) {
+        if (stamp != ru->pendingStamp()
+                        && (stamp & ~STAMP_PENDING) >= PmseSnapshotManager::get().runBase())
+            throw WriteConflictException();
+        return;
+    }
+    if (stamp > ru->snapshot())
+        throw WriteConflictException();
+}
+
+/*
+ * New ids are inserted with reserve/publish, without undo log.
+ * Capped collections and failed reservations fall back to one transaction
+ * writing record and its bucket link. Inserts go to stripes round robin.
+ */
 StatusWith<RecordId> PmseRecordStore::insertRecord(OperationContext* txn,
                                                       const char* data, int len,
                                                       bool enforceQuota) {
-    persistent_ptr<InitData> obj;
-    uint64_t id = 0;
-    try {
-        transaction::exec_tx(mapPool, [&] {
-            obj = pmemobj_tx_alloc(sizeof(InitData::size) + len, 1);
-            obj->size = len;
-            memcpy(obj->data, data, len);
-        });
-    } catch (std::exception &e) {
-        std::cout << e.what() << std::endl;
+    _ensureOpen();
+    auto ru = PmseRecoveryUnit::get(txn);
+    ru->enterEpoch();
+    uint64_t stamp = ru->pendingStamp();
+    auto& stripe = _stripes[_nextStripe++ % _stripes.size()];
+    PMEMobjpool* pm_pool = stripe.mapPool.get_handle();
+    uint64_t id = stripe.mapper->insertReserved(sizeof(InitData) + len, [&](InitData* obj) {
+        fillRecord(pm_pool, obj, data, len, stamp);
+    });
+    if (!id) {
+        try {
+            transaction::exec_tx(stripe.mapPool, [&] {
+                id = stripe.mapper->insert(_allocRecord(stripe, data, len, stamp));
+            });
+        } catch (std::exception &e) {
+            std::cout << e.what() << std::endl;
+            return StatusWith<RecordId>(ErrorCodes::InternalError,
+                                        "Not allocated memory!");
+        }
     }
-    if(obj == nullptr)
-        return StatusWith<RecordId>(ErrorCodes::InternalError,
-                                    "Not allocated memory!");
-    id = mapper->insert(obj);
-    if(!id)
+    if(!id || id == static_cast<uint64_t>(-1))
         return StatusWith<RecordId>(ErrorCodes::OperationFailed,
                                     "Null record Id!");
-    while(mapper->dataSize() > _storageSize) {
+    ru->registerChange(new InsertChange(this, ru, id));
+    while(_dataSize() > _storageSize) {
         _storageSize =  _storageSize + baseSize;
     }
     return StatusWith<RecordId>(RecordId(id));
 }
 
+/*
+ * Update adds new version of record, readers with older snapshots
+ * keep reading previous one.
+ */
 Status PmseRecordStore::updateRecord(
                 OperationContext* txn, const RecordId& oldLocation,
                 const char* data, int len, bool enforceQuota,
                 UpdateNotifier* notifier) {
-    persistent_ptr<InitData> obj;
+    _ensureOpen();
+    auto ru = PmseRecoveryUnit::get(txn);
+    ru->enterEpoch();
+    auto& stripe = _stripeFor(oldLocation.repr());
+    uint64_t oldest = PmseSnapshotManager::get().oldestActive();
+    bool missing = false;
     try {
-        transaction::exec_tx(mapPool, [&] {
-            obj = pmemobj_tx_alloc(sizeof(InitData::size) + len, 1);
-            obj->size = len;
-            memcpy(obj->data, data, len);
-            mapper->updateKV(oldLocation.repr(), obj);
+        transaction::exec_tx(stripe.mapPool, [&] {
+            missing = !stripe.mapper->updateKV(oldLocation.repr(),
+                                               _allocRecord(stripe, data, len,
+                                                            ru->pendingStamp()),
+                                               oldest, [&](persistent_ptr<InitData> newest) {
+                _checkWriteConflict(ru, newest);
+                return !isTombstone(newest.get());
+            });
+            if (missing)
+                pmemobj_tx_abort(ENOENT);
         });
+    } catch (WriteConflictException&) {
+        throw;
     } catch (std::exception &e) {
+        if (missing)
+            return Status(ErrorCodes::NoSuchKey, "Record not found");
         std::cout << e.what() << std::endl;
         return Status(ErrorCodes::BadValue, e.what());
     }
-    while(mapper->dataSize() > _storageSize) {
+    ru->registerChange(new UpdateChange(this, ru, oldLocation.repr()));
+    while(_dataSize() > _storageSize) {
         _storageSize =  _storageSize + baseSize;
     }
     return Status::OK();
 }
 
+/*
+ * Delete links tombstone as new version, readers with older snapshots
+ * keep reading previous one. Record is unlinked by _purgeDeleted.
+ */
 void PmseRecordStore::deleteRecord(OperationContext* txn,
                                       const RecordId& dl) {
-    mapper->remove((uint64_t) dl.repr());
+    _ensureOpen();
+    auto ru = PmseRecoveryUnit::get(txn);
+    ru->enterEpoch();
+    auto& stripe = _stripeFor(dl.repr());
+    uint64_t oldest = PmseSnapshotManager::get().oldestActive();
+    bool missing = false;
+    try {
+        transaction::exec_tx(stripe.mapPool, [&] {
+            missing = !stripe.mapper->updateKV(dl.repr(),
+                                               _allocTombstone(stripe, ru->pendingStamp()),
+                                               oldest, [&](persistent_ptr<InitData> newest) {
+                _checkWriteConflict(ru, newest);
+                return !isTombstone(newest.get());
+            });
+            if (missing)
+                pmemobj_tx_abort(ENOENT);
+        });
+    } catch (WriteConflictException&) {
+        throw;
+    } catch (std::exception&) {
+        if (missing)
+            return;
+        throw;
+    }
+    ru->registerChange(new DeleteChange(this, ru, dl.repr()));
+    _releaseRetired(stripe);
+    _purgeDeleted();
 }
 
 void PmseRecordStore::setCappedCallback(CappedCallback*) {
@@ -165,97 +651,270 @@ void PmseRecordStore::setCappedCallback(CappedCallback*) {
 
 bool PmseRecordStore::findRecord(OperationContext* txn, const RecordId& loc,
                                     RecordData* rd) const {
+    _ensureOpen();
+    auto ru = PmseRecoveryUnit::get(txn);
     persistent_ptr<InitData> obj;
-    if(mapper->find((uint64_t) loc.repr(), obj)){
+    if(_stripeFor(loc.repr()).mapper->find((uint64_t) loc.repr(), obj)){
         invariant(obj != nullptr);
+        obj = visibleVersion(obj, ru->snapshot(), ru->unit());
+        if (obj == nullptr)
+            return false;
+        verifyRecord(obj.get(), loc.repr());
         *rd = RecordData(obj->data, obj->size);
         return true;
     }
     return false;
 }
 
-PmseRecordCursor::PmseRecordCursor(persistent_ptr<PmseMap<InitData>> mapper) {
-    _mapper = mapper;
-    _cur = nullptr;
-}
+/*
+ * Buckets are checked by worker threads, each on its own range.
+ * ValidateAdaptor is not thread safe, calls to it are serialized.
+ */
+Status PmseRecordStore::validate(OperationContext* txn,
+                                 ValidateCmdLevel level,
+                                 ValidateAdaptor* adaptor,
+                                 ValidateResults* results,
+                                 BSONObjBuilder* output) {
+    _ensureOpen();
+    PmseNodeBinding binding(_numaNode);
+    const bool full = (level == kValidateFull);
+    stdx::mutex resultsMutex;
+    stdx::mutex adaptorMutex;
+    PmseBucketCheck total;
+    uint64_t invalidDocuments = 0;
+    uint64_t checksumFailures = 0;
 
-boost::optional<Record> PmseRecordCursor::next() {
-    if(_eof)
-        return boost::none;
-    if(_cur != nullptr) {
-        if(_cur->next != nullptr) {
-            _cur = _cur->next;
-        } else {
-            _cur = nullptr;
-            while(_cur == nullptr && ++actual < _mapper->_size) {
-                persistent_ptr<KVPair> head = _mapper->getFirstPtr(actual);
-                if(head != nullptr) {
-                    _cur = head;
-                    break;
+    for (auto& stripe : _stripes) {
+        auto mapper = stripe.mapper;
+        parallelForRanges(mapper->bucketCount(), pmseWorkerThreads(),
+                          [&](uint64_t begin, uint64_t end) {
+            PmseBucketCheck check;
+            uint64_t invalid = 0;
+            uint64_t badChecksums = 0;
+            mapper->validateBuckets(begin, end, check, [&](persistent_ptr<KVPair> rec) {
+                auto obj = rec->ptr;
+                if (full && !checksumMatches(obj.get())) {
+                    badChecksums++;
+                    check.addError(str::stream() << "record " << rec->idValue
+                                                 << " failed checksum verification");
+                    return;
+                }
+                RecordData data(obj->data, obj->size);
+                size_t dataSize;
+                Status status = Status::OK();
+                {
+                    stdx::lock_guard<stdx::mutex> lock(adaptorMutex);
+                    status = adaptor->validate(data, &dataSize);
+                }
+                if (!status.isOK()) {
+                    invalid++;
+                    check.addError(str::stream() << "record " << rec->idValue
+                                                 << " is corrupted: " << status.reason());
                 }
+            });
+
+            stdx::lock_guard<stdx::mutex> lock(resultsMutex);
+            total.records += check.records;
+            total.dataSize += check.dataSize;
+            total.errorCount += check.errorCount;
+            for (auto &error : check.errors) {
+                if (total.errors.size() < MAX_VALIDATE_ERRORS)
+                    total.errors.push_back(std::move(error));
             }
+            invalidDocuments += invalid;
+            checksumFailures += badChecksums;
+        });
+    }
+
+    if (!_options.capped) {
+        uint64_t records = numRecords(txn);
+        if (total.records != records) {
+            total.addError(str::stream() << "found " << total.records
+                                         << " records, expected " << records);
         }
-    } else {
-        while(_cur == nullptr && actual < _mapper->_size) {
-            persistent_ptr<KVPair> head = _mapper->getFirstPtr(actual);
-            if(head != nullptr) {
-                _cur = head;
-                break;
+        if (total.dataSize != _dataSize()) {
+            total.addError(str::stream() << "data size is " << total.dataSize
+                                         << ", expected " << _dataSize());
+        }
+    }
+
+    if (total.errorCount) {
+        results->valid = false;
+        results->errors.insert(results->errors.end(), total.errors.begin(),
+                               total.errors.end());
+        if (total.errorCount > total.errors.size()) {
+            results->warnings.push_back(str::stream()
+                                        << total.errorCount - total.errors.size()
+                                        << " more errors not listed");
+        }
+    }
+    output->appendNumber("nInvalidDocuments", static_cast<long long>(invalidDocuments));
+    if (full) {
+        output->appendNumber("checksumFailures", static_cast<long long>(checksumFailures));
+    }
+    output->appendNumber("nrecords", static_cast<long long>(total.records));
+    return Status::OK();
+}
+
+/*
+ * Relocates records bucket by bucket. RecordIds don't change,
+ * so indexes are left untouched.
+ */
+Status PmseRecordStore::compact(OperationContext* txn,
+                                RecordStoreCompactAdaptor* adaptor,
+                                const CompactOptions* options,
+                                CompactStats* stats) {
+    _ensureOpen();
+    PmseNodeBinding binding(_numaNode);
+    int64_t reclaimed = 0;
+    try {
+        for (auto& stripe : _stripes) {
+            for (uint64_t i = 0; i < stripe.mapper->bucketCount(); i++) {
+                txn->checkForInterrupt();
+                stdx::lock_guard<stdx::mutex> lock(_reclaimMutex);
+                reclaimed += stripe.mapper->compactBucket(i, COMPACT_BATCH_SIZE);
+                _releaseRetired(stripe);
             }
-            actual++;
         }
+    } catch (nvml::transaction_error &e) {
+        log() << "Compact of " << ns() << " stopped: " << e.what();
+        _compactReclaimed = reclaimed;
+        return Status(ErrorCodes::OperationFailed, e.what());
     }
-    if(_cur == nullptr) {
-        _eof = true;
-        return boost::none;
+    _compactReclaimed = reclaimed;
+    log() << "Compact of " << ns() << " reclaimed " << reclaimed << " bytes";
+    return Status::OK();
+}
+
+uint64_t PmseRecordStore::scrubStep(bool* passDone) {
+    uint64_t bytes = 0;
+    if (!_opened.load(std::memory_order_acquire)) {
+        /* Don't open pools only to scrub them */
+        *passDone = true;
+        return 0;
+    }
+    stdx::lock_guard<stdx::mutex> lock(_reclaimMutex);
+    if (_scrubStripe >= _stripes.size()) {
+        _scrubStripe = 0;
+        _scrubBucket = 0;
+    }
+    auto mapper = _stripes[_scrubStripe].mapper;
+    if (_scrubBucket >= mapper->bucketCount())
+        _scrubBucket = 0;
+    /* Records removed meanwhile are freed only after scrubber leaves epoch */
+    PmseEpochManager& epochs = PmseEpochManager::get();
+    uint64_t epoch = epochs.enter();
+    ON_BLOCK_EXIT([&] { epochs.leave(epoch); });
+    mapper->forEachInBucket(_scrubBucket, [&](persistent_ptr<KVPair> rec) {
+        auto obj = rec->ptr;
+        if (obj == nullptr)
+            return;
+        bytes += obj->size;
+        pmseChecksumStats.scrubbedRecords++;
+        if (checksumMatches(obj.get()))
+            return;
+        /* Record could be replaced meanwhile, check again */
+        persistent_ptr<InitData> current;
+        if (mapper->find(rec->idValue, current) && current == obj
+                        && !checksumMatches(obj.get())) {
+            pmseChecksumStats.scrubFailures++;
+            error() << "Scrubber: checksum mismatch in " << ns() << " record " << rec->idValue;
+        }
+    });
+    pmseChecksumStats.scrubbedBytes += bytes;
+    if (++_scrubBucket >= mapper->bucketCount()) {
+        _scrubBucket = 0;
+        _scrubStripe++;
+    }
+    *passDone = _scrubStripe >= _stripes.size();
+    return bytes;
+}
+
+PmseRecordCursor::PmseRecordCursor(OperationContext* txn,
+                                   std::vector<persistent_ptr<PmseMap<InitData>>> mappers) {
+    _ru = PmseRecoveryUnit::get(txn);
+    _mappers = std::move(mappers);
+    _cur = nullptr;
+}
+
+void PmseRecordCursor::reattachToOperationContext(OperationContext* txn) {
+    _ru = PmseRecoveryUnit::get(txn);
+}
+
+persistent_ptr<InitData> PmseRecordCursor::visible(persistent_ptr<InitData> obj) {
+    return visibleVersion(obj, _ru->snapshot(), _ru->unit());
+}
+
+/*
+ * Moves position to next record. Buckets of stripes are walked in
+ * order, cur is null after last one.
+ */
+void PmseRecordCursor::step(persistent_ptr<KVPair>& cur, size_t& stripe, int& row) const {
+    if(cur != nullptr) {
+        cur = cur->next;
+        if(cur != nullptr)
+            return;
+        row++;
+    }
+    while(stripe < _mappers.size()) {
+        auto mapper = _mappers[stripe];
+        while(row < mapper->_size) {
+            cur = mapper->getFirstPtr(row);
+            if(cur != nullptr)
+                return;
+            row++;
+        }
+        stripe++;
+        row = 0;
     }
+}
+
+void PmseRecordCursor::advance() {
+    step(_cur, _stripe, actual);
+}
+
+/*
+ * Records inserted after snapshot was taken are skipped.
+ */
+boost::optional<Record> PmseRecordCursor::next() {
+    if(_eof)
+        return boost::none;
+    persistent_ptr<InitData> obj;
+    do {
+        advance();
+        if(_cur == nullptr) {
+            _eof = true;
+            return boost::none;
+        }
+        obj = visible(_cur->ptr);
+    } while (obj == nullptr);
+    verifyRecord(obj.get(), _cur->idValue);
     RecordId a((int64_t) _cur->idValue);
-    RecordData b(_cur->ptr->data, _cur->ptr->size);
+    RecordData b(obj->data, obj->size);
     return { {a,b}};
 }
 
 boost::optional<Record> PmseRecordCursor::seekExact(const RecordId& id) {
     persistent_ptr<InitData> obj = nullptr;
-    bool status = _mapper->getPair(id.repr(), _cur);
+    bool status = mapperOf(id.repr())->getPair(id.repr(), _cur);
     if(_cur == nullptr || _cur->ptr == nullptr) {
         return boost::none;
     }
-    obj = _cur->ptr;
+    obj = visible(_cur->ptr);
     if (!status || !obj) {
         return boost::none;
     }
+    verifyRecord(obj.get(), id.repr());
     RecordId a(id.repr());
     RecordData b(obj->data, obj->size);
     return {{a,b}};
 }
 
 void PmseRecordCursor::save() {
-    auto temp = _cur;
-    auto row = actual;
-    if(temp != nullptr) {
-        if(temp->next != nullptr) {
-            temp = temp->next;
-        } else {
-            temp = nullptr;
-            while(temp == nullptr && ++row < _mapper->_size) {
-                persistent_ptr<KVPair> head = _mapper->getFirstPtr(row);
-                if(head != nullptr) {
-                    temp = head;
-                    break;
-                }
-            }
-        }
-    } else {
-        while(temp == nullptr && row < _mapper->_size) {
-            persistent_ptr<KVPair> head = _mapper->getFirstPtr(row);
-            if(head != nullptr) {
-                temp = head;
-                break;
-            }
-            row++;
-        }
-    }
-    _restorePoint = temp;
+    _restorePoint = _cur;
+    _restoreStripe = _stripe;
+    _restoreRow = actual;
+    step(_restorePoint, _restoreStripe, _restoreRow);
 }
 
 bool PmseRecordCursor::restore() {
@@ -265,12 +924,10 @@ bool PmseRecordCursor::restore() {
         _eof = true;
         return true;
     }
-    if(_cur == nullptr) {
-        _cur = _restorePoint;
-        return true;
-    }
-    if(!_mapper->hasId(_cur->idValue)) {
+    if(_cur == nullptr || !mapperOf(_cur->idValue)->hasId(_cur->idValue)) {
         _cur = _restorePoint;
+        _stripe = _restoreStripe;
+        actual = _restoreRow;
     }
     return true;
 }
@@ -279,4 +936,3 @@ void PmseRecordCursor::saveUnpositioned() {
     _eof = true;
 }
 }
-
@@ -33,7 +33,11 @@
 #ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_RECORD_STORE_H_
 #define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_RECORD_STORE_H_
 
+#include <atomic>
 #include <cmath>
+#include <deque>
+#include <string>
+#include <vector>
 
 #include "libpmem.h"
 #include "libpmemobj.h"
@@ -44,8 +48,12 @@
 #include "mongo/platform/basic.h"
 #include "mongo/db/catalog/collection_options.h"
 #include "mongo/stdx/memory.h"
+#include "mongo/stdx/mutex.h"
+#include "mongo/stdx/thread.h"
 
+#include "pmse_dram_index.h"
 #include "pmse_map.h"
+#include "pmse_scrubber.h"
 
 using namespace nvml::obj;
 
@@ -56,13 +64,32 @@ const std::string storeName = "pmse";
 const uint64_t baseSize = 20480;
 }
 
+class PmseRecoveryUnit;
+
 struct root {
     persistent_ptr<PmseMap<InitData>> kvmap_root_ptr;
+    /* Truncated maps waiting for background reclamation */
+    persistent_ptr<PmseMap<InitData>> kvmap_retired_ptr;
+    /* Number of stripes, kept in pool of first stripe only */
+    p<uint64_t> stripeCount;
+};
+
+/*
+ * Part of collection kept in one pool. Not capped collection can be
+ * striped over several pools, record id modulo stripe count selects
+ * the stripe.
+ */
+struct PmseStripe {
+    std::string filename;
+    pool<root> mapPool;
+    persistent_ptr<PmseMap<InitData>> mapper;
+    std::unique_ptr<PmseDramIndex> dramIndex;
 };
 
 class PmseRecordCursor final : public SeekableRecordCursor {
 public:
-    PmseRecordCursor(persistent_ptr<PmseMap<InitData>> mapper);
+    PmseRecordCursor(OperationContext* txn,
+                     std::vector<persistent_ptr<PmseMap<InitData>>> mappers);
 
     boost::optional<Record> next();
 
@@ -72,29 +99,49 @@ public:
 
     bool restore() final;
 
-    void detachFromOperationContext() final {}
+    void detachFromOperationContext() final {
+        _ru = nullptr;
+    }
 
-    void reattachToOperationContext(OperationContext* txn) final {}
+    void reattachToOperationContext(OperationContext* txn) final;
 
     void saveUnpositioned();
 private:
-    persistent_ptr<PmseMap<InitData>> _mapper;
+    void advance();
+    void step(persistent_ptr<KVPair>& cur, size_t& stripe, int& row) const;
+    persistent_ptr<PmseMap<InitData>> mapperOf(uint64_t id) const {
+        return _mappers[id % _mappers.size()];
+    }
+    persistent_ptr<InitData> visible(persistent_ptr<InitData> obj);
+
+    /* Snapshot is taken from recovery unit of current operation */
+    PmseRecoveryUnit* _ru;
+    std::vector<persistent_ptr<PmseMap<InitData>>> _mappers;
     persistent_ptr<KVPair> _cur;
     persistent_ptr<KVPair> _restorePoint;
+    size_t _restoreStripe = 0;
+    int _restoreRow = 0;
     p<bool> _eof = false;
-    p<int> actual = 0;
+    size_t _stripe = 0;
+    int actual = 0;
     PMEMoid _currentOid = OID_NULL;
 };
 
 class PmseRecordStore : public RecordStore {
 public:
     PmseRecordStore(StringData ns, const CollectionOptions& options,
-                       StringData dbpath);
+                       StringData dbpath, const std::string& dbDir = "");
     ~PmseRecordStore() {
-        try {
-            mapPool.close();
-        } catch (std::logic_error &e) {
-            std::cout << e.what() << std::endl;
+        PmseScrubber::get().unregisterStore(this);
+        if (!_opened)
+            return;
+        _stopReclaim();
+        for (auto& stripe : _stripes) {
+            try {
+                stripe.mapPool.close();
+            } catch (std::logic_error &e) {
+                std::cout << e.what() << std::endl;
+            }
         }
     }
 
@@ -105,11 +152,16 @@ public:
     virtual void setCappedCallback(CappedCallback*);
 
     virtual long long dataSize(OperationContext* txn) const {
-        return mapper->dataSize();
+        _ensureOpen();
+        return _dataSize();
     }
 
     virtual long long numRecords(OperationContext* txn) const {
-        return (long long) mapper->fillment();
+        _ensureOpen();
+        long long records = 0;
+        for (const auto& stripe : _stripes)
+            records += stripe.mapper->fillment();
+        return records;
     }
 
     virtual bool isCapped() const {
@@ -173,15 +225,14 @@ public:
 
     std::unique_ptr<SeekableRecordCursor> getCursor(OperationContext* txn,
                                                     bool forward) const final {
-        return stdx::make_unique<PmseRecordCursor>(mapper);
+        _ensureOpen();
+        std::vector<persistent_ptr<PmseMap<InitData>>> mappers;
+        for (const auto& stripe : _stripes)
+            mappers.push_back(stripe.mapper);
+        return stdx::make_unique<PmseRecordCursor>(txn, std::move(mappers));
     }
 
-    virtual Status truncate(OperationContext* txn) {
-        if(!mapper->truncate()) {
-            return Status(ErrorCodes::OperationFailed, "Truncate error");
-        }
-        return Status::OK();
-    }
+    virtual Status truncate(OperationContext* txn);
 
     virtual void temp_cappedTruncateAfter(OperationContext* txn, RecordId end,
                                           bool inclusive) {
@@ -195,6 +246,8 @@ public:
 
     virtual void appendCustomStats(OperationContext* txn,
                                    BSONObjBuilder* result, double scale) const {
+        _ensureOpen();
+        auto mapper = _stripes[0].mapper;
         if(mapper->isCapped()) {
             result->appendNumber("capped", true);
             result->appendNumber("maxSize", floor(mapper->getMax() / scale));
@@ -202,13 +255,33 @@ public:
         } else {
             result->appendNumber("capped", false);
         }
-        result->appendNumber("numInserts", mapper->fillment());
+        result->appendNumber("numInserts", numRecords(txn));
+        result->appendNumber("stripes", static_cast<long long>(_stripes.size()));
+        result->appendNumber("compactBytesReclaimed",
+                             static_cast<long long>(_compactReclaimed));
+        result->appendNumber("numaNode", _numaNode);
     }
 
-    virtual Status touch(OperationContext* txn, BSONObjBuilder* output) const {
-        return Status::OK();
+    /* NUMA node holding pools of collection, -1 when not placed */
+    int numaNode() const {
+        return _numaNode;
+    }
+
+    virtual bool compactSupported() const {
+        return !_options.capped;
     }
 
+    virtual bool compactsInPlace() const {
+        return true;
+    }
+
+    virtual Status compact(OperationContext* txn,
+                           RecordStoreCompactAdaptor* adaptor,
+                           const CompactOptions* options,
+                           CompactStats* stats);
+
+    virtual Status touch(OperationContext* txn, BSONObjBuilder* output) const;
+
     virtual void updateStatsAfterRepair(OperationContext* txn,
                                         long long numRecords,
                                         long long dataSize) {
@@ -223,20 +296,68 @@ public:
                             ValidateCmdLevel level,
                             ValidateAdaptor* adaptor,
                             ValidateResults* results,
-                            BSONObjBuilder* output) {
-        // TODO: Implement validate
-        output->appendNumber("nrecords", mapper->fillment());
-        return Status::OK();
-    }
+                            BSONObjBuilder* output);
+
+    /*
+     * Verify checksums of records in next bucket.
+     * Returns number of scanned bytes, passDone is set after last bucket.
+     */
+    uint64_t scrubStep(bool* passDone);
 
 private:
+    class InsertChange;
+    class DeleteChange;
+    class UpdateChange;
+
+    PmseStripe& _stripeFor(uint64_t id) {
+        return _stripes[id % _stripes.size()];
+    }
+    const PmseStripe& _stripeFor(uint64_t id) const {
+        return _stripes[id % _stripes.size()];
+    }
+    int64_t _dataSize() const;
+    persistent_ptr<PmseMap<InitData>> _newMap(uint64_t stripe);
+    void _openPool(PmseStripe& stripe);
+
+    persistent_ptr<InitData> _allocRecord(PmseStripe& stripe, const char* data, int len,
+                                          uint64_t stamp);
+    persistent_ptr<InitData> _allocTombstone(PmseStripe& stripe, uint64_t stamp);
+    void _queuePurge(uint64_t id, uint64_t stamp);
+    void _purgeDeleted();
+    void _commitVersions(uint64_t id, uint64_t pending, uint64_t stamp);
+    void _releaseRetired(PmseStripe& stripe);
+    void _checkWriteConflict(PmseRecoveryUnit* ru, persistent_ptr<InitData> obj) const;
+    void _ensureOpen() const;
+    void _open();
+    void _startReclaim();
+    void _stopReclaim();
+    void _reclaimRetired();
+
     CappedCallback* _cappedCallback;
     int64_t _storageSize = baseSize;
     CollectionOptions _options;
     long long _numInserts;
     const StringData _DBPATH;
-    pool<root> mapPool;
-    persistent_ptr<PmseMap<InitData>> mapper;
+    /* Subdirectory of database with directoryPerDB, empty otherwise */
+    const std::string _dbDir;
+    std::string _mapperFilename;
+    int _numaNode = -1;
+    mutable stdx::mutex _openMutex;
+    mutable std::atomic<bool> _opened{false};
+    /* Filled when pools are opened, size doesn't change afterwards */
+    std::vector<PmseStripe> _stripes;
+    std::atomic<uint64_t> _nextStripe{0};
+    /* Protects mapper swap and retired maps chain */
+    stdx::mutex _reclaimMutex;
+    stdx::thread _reclaimThread;
+    bool _reclaimRunning = false;
+    std::atomic<bool> _reclaimShutdown{false};
+    /* Committed deletes as (commit stamp, id), in commit order */
+    stdx::mutex _purgeMutex;
+    std::deque<std::pair<uint64_t, uint64_t>> _purgeQueue;
+    uint64_t _scrubStripe = 0;
+    uint64_t _scrubBucket = 0;
+    int64_t _compactReclaimed = 0;
 };
 }
 #endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_RECORD_STORE_H_ */
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mongo/platform/basic.h"
+
+#include "pmse_recovery_unit.h"
+
+#include <exception>
+
+namespace mongo {
+
+PmseRecoveryUnit::~PmseRecoveryUnit() {
+    abandonSnapshot();
+}
+
+void PmseRecoveryUnit::beginUnitOfWork(OperationContext* opCtx) {
+    invariant(!_inUnitOfWork);
+    _inUnitOfWork = true;
+    _unit = PmseSnapshotManager::get().newUnit();
+}
+
+void PmseRecoveryUnit::_commitChanges() {
+    auto& manager = PmseSnapshotManager::get();
+    _commitStamp = manager.beginCommit();
+    for (auto& change : _changes) {
+        try {
+            change->commit();
+        } catch (...) {
+            std::terminate();
+        }
+    }
+    manager.endCommit(_commitStamp);
+    _commitStamp = 0;
+    _changes.clear();
+}
+
+void PmseRecoveryUnit::commitUnitOfWork() {
+    invariant(_inUnitOfWork);
+    _commitChanges();
+    _inUnitOfWork = false;
+    abandonSnapshot();
+}
+
+void PmseRecoveryUnit::abortUnitOfWork() {
+    invariant(_inUnitOfWork);
+    for (auto it = _changes.rbegin(); it != _changes.rend(); ++it) {
+        try {
+            (*it)->rollback();
+        } catch (...) {
+            std::terminate();
+        }
+    }
+    _changes.clear();
+    _inUnitOfWork = false;
+    abandonSnapshot();
+}
+
+void PmseRecoveryUnit::abandonSnapshot() {
+    if (_snapshot) {
+        PmseSnapshotManager::get().unpin(_snapshot);
+        _snapshot = 0;
+    }
+    if (_epoch) {
+        PmseEpochManager::get().leave(_epoch);
+        _epoch = 0;
+    }
+}
+
+void PmseRecoveryUnit::enterEpoch() {
+    if (!_epoch)
+        _epoch = PmseEpochManager::get().enter();
+}
+
+uint64_t PmseRecoveryUnit::snapshot() {
+    enterEpoch();
+    if (!_snapshot) {
+        _snapshot = PmseSnapshotManager::get().pin();
+        _snapshotCount++;
+    }
+    return _snapshot;
+}
+
+uint64_t PmseRecoveryUnit::pendingStamp() const {
+    return STAMP_PENDING | (_inUnitOfWork ? _unit : 0);
+}
+
+/*
+ * Writes done outside of unit of work can't be rolled back,
+ * they are committed immediately.
+ */
+void PmseRecoveryUnit::registerChange(Change* change) {
+    _changes.push_back(std::unique_ptr<Change>(change));
+    if (!_inUnitOfWork)
+        _commitChanges();
+}
+
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_RECOVERY_UNIT_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_RECOVERY_UNIT_H_
+
+#include <memory>
+#include <vector>
+
+#include "mongo/db/operation_context.h"
+#include "mongo/db/storage/recovery_unit.h"
+#include "mongo/util/assert_util.h"
+#include "mongo/util/checked_cast.h"
+
+#include "pmse_epoch.h"
+#include "pmse_snapshot.h"
+
+namespace mongo {
+
+/*
+ * Unit of work spans collection pool and index pools, and one pmem
+ * transaction can't span several pools. Every write is persisted in its
+ * own pool transaction and registers logical undo, which is applied in
+ * reverse order when unit of work is aborted.
+ *
+ * Readers pin snapshot on first read, it's kept until snapshot is
+ * abandoned or unit of work ends. Epoch is held as long as snapshot,
+ * so persistent objects seen through it aren't freed meanwhile. Versions written by unit of work get
+ * one commit stamp when it commits.
+ */
+class PmseRecoveryUnit : public RecoveryUnit {
+public:
+    ~PmseRecoveryUnit();
+
+    static PmseRecoveryUnit* get(OperationContext* txn) {
+        return checked_cast<PmseRecoveryUnit*>(txn->recoveryUnit());
+    }
+
+    void beginUnitOfWork(OperationContext* opCtx) final;
+    void commitUnitOfWork() final;
+    void abortUnitOfWork() final;
+
+    bool waitUntilDurable() final {
+        return true;
+    }
+
+    void abandonSnapshot() final;
+
+    void registerChange(Change* change) final;
+
+    void* writingPtr(void* data, size_t len) final {
+        MONGO_UNREACHABLE;
+    }
+
+    void setRollbackWritesDisabled() final {}
+
+    SnapshotId getSnapshotId() const final {
+        return SnapshotId(_snapshotCount);
+    }
+
+    uint64_t snapshot();
+
+    void enterEpoch();
+
+    /* Stamp for versions written in current unit of work */
+    uint64_t pendingStamp() const;
+
+    /* Unit whose pending versions are visible to this reader */
+    uint64_t unit() const {
+        return _inUnitOfWork ? _unit : NO_UNIT;
+    }
+
+    /* Valid only while changes are committed */
+    uint64_t commitStamp() const {
+        return _commitStamp;
+    }
+
+private:
+    void _commitChanges();
+
+    bool _inUnitOfWork = false;
+    uint64_t _unit = 0;
+    uint64_t _snapshot = 0;
+    uint64_t _snapshotCount = 0;
+    uint64_t _epoch = 0;
+    uint64_t _commitStamp = 0;
+    std::vector<std::unique_ptr<Change>> _changes;
+};
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_RECOVERY_UNIT_H_ */
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define MONGO_LOG_DEFAULT_COMPONENT ::mongo::logger::LogComponent::kStorage
+
+#include "mongo/platform/basic.h"
+#include "mongo/stdx/chrono.h"
+#include "mongo/util/log.h"
+
+#include "pmse_checksum.h"
+#include "pmse_record_store.h"
+#include "pmse_scrubber.h"
+
+#include <algorithm>
+
+namespace mongo {
+
+PmseScrubber& PmseScrubber::get() {
+    static PmseScrubber scrubber;
+    return scrubber;
+}
+
+void PmseScrubber::registerStore(PmseRecordStore* store) {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    _stores.push_back(store);
+}
+
+void PmseScrubber::unregisterStore(PmseRecordStore* store) {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    _stores.erase(std::remove(_stores.begin(), _stores.end(), store), _stores.end());
+}
+
+void PmseScrubber::start(uint64_t bytesPerSecond) {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    if (_running)
+        return;
+    _bytesPerSecond = bytesPerSecond;
+    _shutdown = false;
+    _running = true;
+    _thread = stdx::thread([this] { _run(); });
+    log() << "PMSE scrubber started";
+}
+
+void PmseScrubber::shutdown() {
+    {
+        stdx::lock_guard<stdx::mutex> lock(_mutex);
+        if (!_running)
+            return;
+        _shutdown = true;
+        _running = false;
+    }
+    _wakeup.notify_all();
+    _thread.join();
+}
+
+void PmseScrubber::appendStats(BSONObjBuilder* builder) const {
+    BSONObjBuilder scrubber(builder->subobjStart("scrubber"));
+    {
+        stdx::lock_guard<stdx::mutex> lock(_mutex);
+        scrubber.appendBool("running", _running);
+        scrubber.appendNumber("collections", static_cast<long long>(_stores.size()));
+    }
+    scrubber.appendNumber("passes", static_cast<long long>(pmseChecksumStats.scrubPasses.load()));
+    scrubber.appendNumber("records", static_cast<long long>(pmseChecksumStats.scrubbedRecords.load()));
+    scrubber.appendNumber("bytes", static_cast<long long>(pmseChecksumStats.scrubbedBytes.load()));
+    scrubber.appendNumber("checksumFailures", static_cast<long long>(pmseChecksumStats.scrubFailures.load()));
+    scrubber.done();
+}
+
+void PmseScrubber::_run() {
+    stdx::unique_lock<stdx::mutex> lock(_mutex);
+    while (!_shutdown) {
+        if (_stores.empty()) {
+            _wakeup.wait_for(lock, stdx::chrono::seconds(1));
+            continue;
+        }
+        if (_next >= _stores.size())
+            _next = 0;
+
+        bool passDone = false;
+        uint64_t bytes = 0;
+        try {
+            bytes = _stores[_next]->scrubStep(&passDone);
+        } catch (std::exception &e) {
+            log() << "PMSE scrubber: " << e.what();
+            passDone = true;
+        }
+        bool roundDone = false;
+        if (passDone && ++_next >= _stores.size()) {
+            _next = 0;
+            pmseChecksumStats.scrubPasses++;
+            roundDone = true;
+        }
+
+        /* Empty buckets and not opened collections still pause, round ends with 1s tick */
+        auto pause = stdx::chrono::microseconds(bytes * 1000000 / _bytesPerSecond);
+        if (roundDone)
+            pause = std::max<stdx::chrono::microseconds>(pause, stdx::chrono::seconds(1));
+        else
+            pause = std::max(pause, SCRUB_MIN_PAUSE);
+        _wakeup.wait_for(lock, pause, [this] { return _shutdown; });
+    }
+}
+
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_SCRUBBER_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_SCRUBBER_H_
+
+#include <vector>
+
+#include "mongo/bson/bsonobjbuilder.h"
+#include "mongo/stdx/chrono.h"
+#include "mongo/stdx/condition_variable.h"
+#include "mongo/stdx/mutex.h"
+#include "mongo/stdx/thread.h"
+
+namespace mongo {
+
+class PmseRecordStore;
+
+/* Shortest pause between two scrubbed buckets */
+const stdx::chrono::microseconds SCRUB_MIN_PAUSE(1000);
+
+/*
+ * Background thread verifying record checksums of all open collections.
+ * Collections are scrubbed one bucket at a time, after each bucket
+ * scrubber sleeps long enough to keep configured rate, at least
+ * SCRUB_MIN_PAUSE.
+ */
+class PmseScrubber {
+public:
+    static PmseScrubber& get();
+
+    void registerStore(PmseRecordStore* store);
+    void unregisterStore(PmseRecordStore* store);
+
+    void start(uint64_t bytesPerSecond);
+    void shutdown();
+
+    void appendStats(BSONObjBuilder* builder) const;
+
+private:
+    PmseScrubber() = default;
+    void _run();
+
+    /* Held while collection is scrubbed, so it can't be destroyed meanwhile */
+    mutable stdx::mutex _mutex;
+    stdx::condition_variable _wakeup;
+    std::vector<PmseRecordStore*> _stores;
+    size_t _next = 0;
+    uint64_t _bytesPerSecond = 0;
+    bool _running = false;
+    bool _shutdown = false;
+    stdx::thread _thread;
+};
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_SCRUBBER_H_ */
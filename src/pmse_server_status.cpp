@@ -0,0 +1,61 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mongo/platform/basic.h"
+#include "mongo/bson/bsonobjbuilder.h"
+
+#include "pmse_checksum.h"
+#include "pmse_numa.h"
+#include "pmse_scrubber.h"
+#include "pmse_server_status.h"
+
+namespace mongo {
+
+PmseServerStatusSection::PmseServerStatusSection() : ServerStatusSection("pmse") {}
+
+bool PmseServerStatusSection::includeByDefault() const {
+    return true;
+}
+
+BSONObj PmseServerStatusSection::generateSection(OperationContext* txn,
+                                                 const BSONElement& configElement) const {
+    BSONObjBuilder bob;
+    BSONObjBuilder checksums(bob.subobjStart("checksums"));
+    checksums.appendNumber("readFailures",
+                           static_cast<long long>(pmseChecksumStats.readFailures.load()));
+    checksums.done();
+    PmseScrubber::get().appendStats(&bob);
+    pmseAppendNumaStats(&bob);
+    return bob.obj();
+}
+
+}
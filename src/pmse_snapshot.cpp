@@ -0,0 +1,116 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mongo/platform/basic.h"
+
+#include "pmse_snapshot.h"
+
+#include <algorithm>
+
+namespace mongo {
+
+PmseSnapshotManager& PmseSnapshotManager::get() {
+    static PmseSnapshotManager manager;
+    return manager;
+}
+
+void PmseSnapshotManager::init(uint64_t generation) {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    _runBase = generation << STAMP_GENERATION_SHIFT;
+    _nextStamp = _runBase + 1;
+    _nextUnit = _runBase + 1;
+}
+
+uint64_t PmseSnapshotManager::_visible() const {
+    if (_inFlight.empty())
+        return _nextStamp - 1;
+    return *_inFlight.begin() - 1;
+}
+
+uint64_t PmseSnapshotManager::beginCommit() {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    uint64_t stamp = _nextStamp++;
+    _inFlight.insert(stamp);
+    return stamp;
+}
+
+void PmseSnapshotManager::endCommit(uint64_t stamp) {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    _inFlight.erase(stamp);
+}
+
+uint64_t PmseSnapshotManager::pin() {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    uint64_t snapshot = _visible();
+    _pinned.insert(snapshot);
+    return snapshot;
+}
+
+void PmseSnapshotManager::unpin(uint64_t snapshot) {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    auto it = _pinned.find(snapshot);
+    if (it != _pinned.end())
+        _pinned.erase(it);
+}
+
+uint64_t PmseSnapshotManager::oldestActive() const {
+    stdx::lock_guard<stdx::mutex> lock(_mutex);
+    if (_pinned.empty())
+        return _visible();
+    return std::min(*_pinned.begin(), _visible());
+}
+
+void pruneVersions(persistent_ptr<InitData> obj, uint64_t oldest) {
+    for (; obj != nullptr; obj = persistent_ptr<InitData>(obj->older)) {
+        if (!versionVisible(obj.get(), oldest, NO_UNIT))
+            continue;
+        persistent_ptr<InitData> older(obj->older);
+        if (older != nullptr) {
+            pmemobj_tx_add_range_direct(&obj->older, sizeof(obj->older));
+            obj->older = OID_NULL;
+            deleteVersions(older);
+        }
+        return;
+    }
+}
+
+void commitVersions(persistent_ptr<InitData> obj, uint64_t pending, uint64_t stamp) {
+    PMEMobjpool* pop = pmemobj_pool_by_ptr(obj.get());
+    for (; obj != nullptr; obj = persistent_ptr<InitData>(obj->older)) {
+        if (obj->stamp != pending)
+            break;
+        obj->stamp = stamp;
+        pmemobj_persist(pop, &obj->stamp, sizeof(obj->stamp));
+    }
+}
+
+}
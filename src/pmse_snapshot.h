@@ -0,0 +1,129 @@
+/*
+ * Copyright 2014-2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_SNAPSHOT_H_
+#define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_SNAPSHOT_H_
+
+#include <atomic>
+#include <set>
+
+#include "mongo/stdx/mutex.h"
+
+#include "pmse_list_int_ptr.h"
+
+namespace mongo {
+
+/*
+ * Record versions carry commit stamp of unit of work which wrote them.
+ * Until commit stamp is STAMP_PENDING with id of writing unit in low bits.
+ * Stamps and unit ids of each engine run start at generation << 40,
+ * so pending versions left by crashed run are older than anything
+ * written afterwards and are treated as committed.
+ * Delete links tombstone as newest version, record is unlinked once
+ * every snapshot sees the tombstone.
+ */
+const uint64_t STAMP_PENDING = 1ULL << 63;
+const uint64_t STAMP_LATEST = STAMP_PENDING - 1;
+const uint64_t NO_UNIT = ~0ULL;
+const int STAMP_GENERATION_SHIFT = 40;
+
+class PmseSnapshotManager {
+public:
+    static PmseSnapshotManager& get();
+
+    void init(uint64_t generation);
+
+    uint64_t runBase() const {
+        return _runBase;
+    }
+
+    uint64_t newUnit() {
+        return _nextUnit++;
+    }
+
+    /* Stamp is visible to new snapshots after endCommit */
+    uint64_t beginCommit();
+    void endCommit(uint64_t stamp);
+
+    uint64_t pin();
+    void unpin(uint64_t snapshot);
+
+    /* Oldest snapshot any reader may still use */
+    uint64_t oldestActive() const;
+
+private:
+    PmseSnapshotManager() = default;
+    uint64_t _visible() const;
+
+    mutable stdx::mutex _mutex;
+    uint64_t _runBase = 0;
+    uint64_t _nextStamp = 1;
+    std::atomic<uint64_t> _nextUnit{1};
+    std::set<uint64_t> _inFlight;
+    std::multiset<uint64_t> _pinned;
+};
+
+inline bool versionVisible(const InitData* obj, uint64_t snapshot, uint64_t unit) {
+    uint64_t stamp = obj->stamp;
+    if (stamp & STAMP_PENDING) {
+        uint64_t owner = stamp & ~STAMP_PENDING;
+        return owner == unit || owner < PmseSnapshotManager::get().runBase();
+    }
+    return stamp <= snapshot;
+}
+
+/*
+ * Newest version of record visible in snapshot, nullptr when record
+ * was inserted after snapshot was taken or deleted before.
+ */
+inline persistent_ptr<InitData> visibleVersion(persistent_ptr<InitData> obj,
+                                               uint64_t snapshot, uint64_t unit) {
+    while (obj != nullptr && !versionVisible(obj.get(), snapshot, unit))
+        obj = persistent_ptr<InitData>(obj->older);
+    if (obj != nullptr && isTombstone(obj.get()))
+        return nullptr;
+    return obj;
+}
+
+/*
+ * Frees versions older than the one visible in oldest snapshot.
+ * Must be called inside transaction.
+ */
+void pruneVersions(persistent_ptr<InitData> obj, uint64_t oldest);
+
+/*
+ * Replaces pending stamp of versions written by one unit with commit stamp.
+ */
+void commitVersions(persistent_ptr<InitData> obj, uint64_t pending, uint64_t stamp);
+
+}
+#endif /* SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_SNAPSHOT_H_ */
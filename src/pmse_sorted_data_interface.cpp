@@ -32,8 +32,18 @@
 
 #define MONGO_LOG_DEFAULT_COMPONENT ::mongo::logger::LogComponent::kStorage
 
+#include "mongo/db/operation_context.h"
+#include "mongo/db/storage/recovery_unit.h"
+#include "mongo/util/log.h"
+
 #include "pmse_sorted_data_interface.h"
+#include "pmse_global_options.h"
 #include "pmse_index_cursor.h"
+#include "pmse_numa.h"
+#include "pmse_prefault.h"
+#include "pmse_recovery_unit.h"
+
+#include <boost/filesystem.hpp>
 
 namespace mongo {
 
@@ -41,21 +51,106 @@ PmseSortedDataInterface::PmseSortedDataInterface(StringData ident,
                                                  const IndexDescriptor* desc,
                                                  StringData dbpath) {
     filepath = dbpath;
-    std::string filename = filepath.toString() + ident.toString();
+    /* Index is placed on the same node as its collection */
+    _filename = pmsePoolPath(filepath.toString(), ident.toString(),
+                             desc->parentNS());
+    _numaNode = pmseNodeOfPath(_filename);
     _desc = desc;
+    if (pmseGlobalOptions.touchOnStartup != kTouchNone) {
+        _ensureOpen();
+    }
+}
+
+/*
+ * Index pool is opened on first access, same as in record store.
+ */
+void PmseSortedDataInterface::_ensureOpen() const {
+    if (_opened.load(std::memory_order_acquire))
+        return;
+    stdx::lock_guard<stdx::mutex> lock(_openMutex);
+    if (_opened.load(std::memory_order_relaxed))
+        return;
+    const_cast<PmseSortedDataInterface*>(this)->_open();
+    _opened.store(true, std::memory_order_release);
+}
 
-    if (access(filename.c_str(), F_OK) != 0) {
-        pm_pool = pool<PmseTree>::create(filename.c_str(), "pmse",
+void PmseSortedDataInterface::_open() {
+    PmseNodeBinding binding(_numaNode);
+    if (access(_filename.c_str(), F_OK) != 0) {
+        boost::filesystem::create_directories(
+                        boost::filesystem::path(_filename).parent_path());
+        pm_pool = pool<PmseTree>::create(_filename.c_str(), "pmse",
                         10 * PMEMOBJ_MIN_POOL, 0666);
     } else {
-        pm_pool = pool<PmseTree>::open(filename.c_str(), "pmse");
-        std::cout << " openPool = " << std::endl;
-
+        pm_pool = pool<PmseTree>::open(_filename.c_str(), "pmse");
+        log() << "Opened index pool " << _filename;
     }
     tree = pm_pool.get_root();
+    if (tree->fanout() == 0) {
+        /* New index, fanout and leaf format are fixed for its lifetime */
+        transaction::exec_tx(pm_pool, [&] {
+            tree->setFanout(pmseTreeFanout(_desc->keyPattern()));
+            tree->setUnsortedLeaves(pmseGlobalOptions.unsortedLeaves);
+            tree->setVolatileInnerNodes(pmseGlobalOptions.volatileInnerNodes);
+        });
+    }
+    _impl = pmseOpenTree(pm_pool, tree, _desc->keyPattern());
+    while (tree->releaseRetired(pm_pool, ~0ULL, RELEASE_BATCH_SIZE) > 0) {}
+    if (pmseGlobalOptions.touchOnStartup == kTouchFull) {
+        prefaultPool(pm_pool.get_handle(), _filename);
+    } else if (pmseGlobalOptions.touchOnStartup == kTouchMetadata) {
+        _impl->prefaultInnerNodes();
+    }
+}
 
+Status PmseSortedDataInterface::touch(OperationContext* txn) const {
+    _ensureOpen();
+    PmseNodeBinding binding(_numaNode);
+    prefaultPool(pmemobj_pool_by_ptr(tree.get()), _filename);
+    return Status::OK();
 }
 
+/*
+ * Undo of index writes, applied when unit of work is aborted.
+ */
+class PmseSortedDataInterface::InsertChange : public RecoveryUnit::Change {
+public:
+    InsertChange(PmseSortedDataInterface* index, const BSONObj& key,
+                 const RecordId& loc, bool dupsAllowed)
+        : _index(index), _key(key), _loc(loc), _dupsAllowed(dupsAllowed) {}
+
+    void commit() final {}
+
+    void rollback() final {
+        _index->_unindexKey(_key, _loc, _dupsAllowed);
+    }
+
+private:
+    PmseSortedDataInterface* _index;
+    BSONObj _key;
+    RecordId _loc;
+    bool _dupsAllowed;
+};
+
+class PmseSortedDataInterface::UnindexChange : public RecoveryUnit::Change {
+public:
+    UnindexChange(PmseSortedDataInterface* index, const BSONObj& key,
+                  const RecordId& loc, bool dupsAllowed)
+        : _index(index), _key(key), _loc(loc), _dupsAllowed(dupsAllowed) {}
+
+    void commit() final {}
+
+    void rollback() final {
+        _index->_insertKey(_key, _loc, _dupsAllowed);
+    }
+
+private:
+    PmseSortedDataInterface* _index;
+    BSONObj _key;
+    RecordId _loc;
+    bool _dupsAllowed;
+};
+
 /*
  * Insert new (Key,RecordID) into Sorted Index into correct place. Placement must be chosen basing on key value.
  *
@@ -63,50 +158,105 @@ PmseSortedDataInterface::PmseSortedDataInterface(StringData ident,
 Status PmseSortedDataInterface::insert(OperationContext* txn,
                                        const BSONObj& key, const RecordId& loc,
                                        bool dupsAllowed) {
-
-    BSONObj_PM bsonPM;
+    _ensureOpen();
+    PmseRecoveryUnit::get(txn)->enterEpoch();
     BSONObj owned = key.getOwned();
-    Status status = Status::OK();
+    Status status = _insertKey(owned, loc, dupsAllowed);
+    if (status.isOK())
+        txn->recoveryUnit()->registerChange(new InsertChange(this, owned, loc, dupsAllowed));
+    return status;
+}
 
-    persistent_ptr<char> obj;
+/*
+ * Key copy and tree update are done in one transaction, rejected key
+ * aborts it so its copy isn't leaked. Duplicate is checked by tree with
+ * leaf latched. Queued changes of DRAM inner nodes are applied and
+ * latches released when transaction has ended.
+ */
+Status PmseSortedDataInterface::_insertKey(const BSONObj& key, const RecordId& loc,
+                                           bool dupsAllowed) {
+    Status status = Status::OK();
+    PmseLatchSet latches(_impl->latchTable());
 
     try {
-        transaction::exec_tx(pm_pool,
-                        [&] {
-                            obj = pmemobj_tx_alloc(owned.objsize(), 1);
-                            memcpy( (void*)obj.get(), owned.objdata(), owned.objsize());
-                        });
-
-    bsonPM.data = obj;
-    status = tree->insert(pm_pool, bsonPM, loc, _desc->keyPattern(), dupsAllowed);
-    ++_records;
+        transaction::exec_tx(pm_pool, [&] {
+            status = _impl->insert(key, loc, dupsAllowed, latches);
+            if (!status.isOK())
+                pmemobj_tx_abort(ECANCELED);
+        });
+        latches.commit();
     } catch (std::exception &e) {
-            std::cout << e.what() << std::endl;
+        if (status.isOK()) {
+            error() << "Insert into index " << _desc->indexName() << " failed: " << e.what();
+            status = Status(ErrorCodes::InternalError, e.what());
+        }
     }
+    latches.release();
+    if (status.code() == ErrorCodes::DuplicateKey)
+        return _dupKeyError(key);
+    if (status.isOK())
+        ++_records;
     return status;
 }
 
+Status PmseSortedDataInterface::dupKeyCheck(OperationContext* txn,
+                                            const BSONObj& key,
+                                            const RecordId& loc) {
+    _ensureOpen();
+    PmseRecoveryUnit::get(txn)->enterEpoch();
+    if (_impl->hasDuplicate(key, loc))
+        return _dupKeyError(key);
+    return Status::OK();
+}
+
+Status PmseSortedDataInterface::_dupKeyError(const BSONObj& key) const {
+    StringBuilder sb;
+    sb << "E11000 duplicate key error";
+    sb << " index: " << _desc->indexName();
+    sb << " dup key: " << key;
+    return Status(ErrorCodes::DuplicateKey, sb.str());
+}
+
 /*
  * Remove given record from Sorted Index *
  */
 void PmseSortedDataInterface::unindex(OperationContext* txn, const BSONObj& key,
                                       const RecordId& loc, bool dupsAllowed) {
+    _ensureOpen();
+    PmseRecoveryUnit::get(txn)->enterEpoch();
     BSONObj owned = key.getOwned();
+    if (_unindexKey(owned, loc, dupsAllowed))
+        txn->recoveryUnit()->registerChange(new UnindexChange(this, owned, loc, dupsAllowed));
+    tree->releaseRetired(pm_pool, PmseEpochManager::get().tryAdvance(), RELEASE_BATCH_SIZE);
+}
+
+/*
+ * Returns true if entry was removed, missing entry changes nothing.
+ */
+bool PmseSortedDataInterface::_unindexKey(const BSONObj& key, const RecordId& loc,
+                                          bool dupsAllowed) {
+    BSONObj owned = key;
+    PmseLatchSet latches(_impl->latchTable());
+    bool removed = false;
     try {
         transaction::exec_tx(pm_pool,
         [&] {
-            tree->remove(pm_pool, owned, loc, dupsAllowed, _desc->keyPattern());
+            removed = _impl->remove(owned, loc, dupsAllowed, latches);
         });
-        --_records;
+        latches.commit();
     } catch (std::exception &e) {
-        std::cout << e.what() << std::endl;
+        error() << "Remove from index " << _desc->indexName() << " failed: " << e.what();
+        removed = false;
     }
-
+    if (removed)
+        --_records;
+    return removed;
 }
 
 std::unique_ptr<SortedDataInterface::Cursor> PmseSortedDataInterface::newCursor(
                 OperationContext* txn, bool isForward) const {
-    return stdx::make_unique <PmseCursor> (txn, isForward, tree, _desc->keyPattern(), _desc->unique());
+    _ensureOpen();
+    return _impl->newCursor(txn, isForward);
 }
 
 class PMStoreSortedDataBuilderInterface : public SortedDataBuilderInterface {
@@ -36,6 +36,9 @@
 #include "mongo/db/storage/sorted_data_interface.h"
 #include "mongo/db/index/index_descriptor.h"
 #include "mongo/bson/bsonobj_comparator.h"
+#include "mongo/stdx/mutex.h"
+
+#include <atomic>
 
 #include <libpmemobj.h>
 #include <libpmemobj++/persistent_ptr.hpp>
@@ -65,10 +68,7 @@ public:
                          const RecordId& loc, bool dupsAllowed);
 
     virtual Status dupKeyCheck(OperationContext* txn, const BSONObj& key,
-                               const RecordId& loc) {
-        // TODO: Implement dupKeyCheck
-        return Status::OK();
-    }
+                               const RecordId& loc);
 
     virtual void fullValidate(OperationContext* txn, long long* numKeysOut,
                               ValidateResults* fullResults) const {
@@ -99,12 +99,28 @@ public:
     std::unique_ptr<SortedDataInterface::Cursor> newCursor(
                     OperationContext* txn, bool isForward) const;
 
+    virtual Status touch(OperationContext* txn) const;
+
 private:
+    class InsertChange;
+    class UnindexChange;
+
+    Status _dupKeyError(const BSONObj& key) const;
+    Status _insertKey(const BSONObj& key, const RecordId& loc, bool dupsAllowed);
+    bool _unindexKey(const BSONObj& key, const RecordId& loc, bool dupsAllowed);
+    void _ensureOpen() const;
+    void _open();
     void moveToNext();
-    p<int> _records;
+    /* Changed by concurrent writers */
+    std::atomic<long long> _records{0};
     StringData filepath;
+    std::string _filename;
+    int _numaNode = -1;
+    mutable stdx::mutex _openMutex;
+    mutable std::atomic<bool> _opened{false};
     pool<PmseTree> pm_pool;
     persistent_ptr<PmseTree> tree;
+    std::unique_ptr<PmseTreeBase> _impl;
     const IndexDescriptor* _desc;
 
 };
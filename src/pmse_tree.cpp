@@ -34,85 +34,932 @@
 
 #include "mongo/platform/basic.h"
 #include "mongo/db/storage/sorted_data_interface.h"
+#include "mongo/util/bufreader.h"
 #include "mongo/util/log.h"
+#include "mongo/util/mongoutils/str.h"
 #include "mongo/stdx/memory.h"
 
+#include "pmse_global_options.h"
+#include "pmse_index_cursor.h"
+#include "pmse_parallel.h"
+#include "pmse_prefault.h"
 #include "pmse_tree.h"
 #include "pmse_sorted_data_interface.h"
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
 #include "errno.h"
 #include "libpmemobj++/transaction.hpp"
 #include "libpmemobj++/make_persistent_array.hpp"
 
 namespace mongo {
 
-void PmseTree::remove(pool_base pop, BSONObj& key, const RecordId& loc,
-                      bool dupsAllowed, const BSONObj& ordering) {
+/*
+ * Index keys are KeyString encoded, about 10 bytes per value is
+ * assumed. Largest fanout whose slots fit TREE_NODE_BYTES is used.
+ */
+uint64_t pmseTreeFanout(const BSONObj& keyPattern) {
+    uint64_t keySize = 1 + keyPattern.nFields() * (2 + sizeof(int64_t));
+    uint64_t slotSize = sizeof(PmseKey) + sizeof(uint64_t) + sizeof(RecordId);
+    if (keySize > static_cast<uint64_t>(TREE_INLINE_KEY_SIZE))
+        slotSize += keySize;
+    uint64_t fanout = TREE_FANOUT_MAX;
+    while (fanout > TREE_FANOUT_MIN && fanout * slotSize > TREE_NODE_BYTES)
+        fanout /= 2;
+    return fanout;
+}
 
-    persistent_ptr<PmseTreeNode> node;
-    RecordId key_record;
-    uint64_t recordIndex;
-    uint64_t i;
-    int64_t cmp;
-    _ordering = ordering;
-
-    //find node with key
-    node = locateLeafWithKey(root, key, _ordering);
-    //find place in node
-    for (i = 0; i < node->num_keys; i++) {
-        key_record = node->values_array[i];
-        cmp = key.woCompare(node->keys[i].getBSON(), _ordering, false);
-        if (cmp == 0) {
-            key_record = node->values_array[i];
-            recordIndex = i;
-            if (dupsAllowed) {
-                if (key_record.repr() != loc.repr()) {
-                    while ((key.woCompare(node->keys[i].getBSON(), _ordering,
-                                    false) == 0)
-                                    && (node->values_array[i]).repr()
-                                                    != loc.repr()) {
-                        if (i > 0) {
-                            i--;
-                        } else {
-                            if (node->previous) {
-                                node = node->previous;
-                                i = node->num_keys - 1;
-                            } else {
-                                return;
-                            }
-                        }
-                    }
-                }
+template <uint64_t ORDER>
+PmseTreeImpl<ORDER>::PmseTreeImpl(pool_base pop, persistent_ptr<PmseTree> tree,
+                                  const BSONObj& keyPattern)
+    : _pop(pop), _tree(tree), _keyOrdering(Ordering::make(keyPattern)),
+      _unsorted(tree->unsortedLeaves()), _volatileInner(tree->volatileInnerNodes()),
+      _latches(pmseGlobalOptions.indexLatchWords) {
+    if (_unsorted)
+        repairLeafSlots();
+    if (_volatileInner)
+        rebuildInnerNodes();
+}
+
+std::unique_ptr<PmseTreeBase> pmseOpenTree(pool_base pop, persistent_ptr<PmseTree> tree,
+                                           const BSONObj& keyPattern) {
+    switch (tree->fanout()) {
+    case 16:
+        return stdx::make_unique<PmseTreeImpl<16>>(pop, tree, keyPattern);
+    case 32:
+        return stdx::make_unique<PmseTreeImpl<32>>(pop, tree, keyPattern);
+    case 64:
+        return stdx::make_unique<PmseTreeImpl<64>>(pop, tree, keyPattern);
+    case 128:
+        return stdx::make_unique<PmseTreeImpl<128>>(pop, tree, keyPattern);
+    default:
+        uasserted(ErrorCodes::InternalError,
+                  str::stream() << "Unsupported index fanout " << tree->fanout());
+    }
+}
+
+namespace {
+
+/* Heads left by binary search in node, they are scanned */
+const uint64_t HEAD_WINDOW = 8;
+
+/* Number of leading bytes equal in both keys, up to limit */
+uint64_t commonBytes(StringData a, StringData b, uint64_t limit) {
+    uint64_t size = std::min<uint64_t>(limit, std::min(a.size(), b.size()));
+    uint64_t i = 0;
+    while (i < size && a[i] == b[i])
+        i++;
+    return i;
+}
+
+/* Type bits needed to decode key, empty if all are zero */
+StringData typeBitsOf(const KeyString& ks) {
+    const KeyString::TypeBits& bits = ks.getTypeBits();
+    if (bits.isAllZeros())
+        return StringData();
+    return StringData(bits.getBuffer(), bits.getSize());
+}
+
+KeyString::TypeBits decodeTypeBits(StringData bits) {
+    if (bits.empty())
+        return KeyString::TypeBits(TREE_KEY_VERSION);
+    BufReader reader(bits.rawData(), bits.size());
+    return KeyString::TypeBits::fromBuffer(TREE_KEY_VERSION, &reader);
+}
+
+/*
+ * Index of first fingerprint equal to fp in [from, count), count if
+ * there is none. Compares 16 fingerprints at once with SSE2.
+ */
+uint64_t findFingerprint(const uint8_t* fps, uint64_t size, uint64_t from,
+                         uint64_t count, uint8_t fp) {
+#if defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi8(static_cast<char>(fp));
+    while (from < count && from + 16 <= size) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fps + from));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0) {
+            uint64_t i = from + __builtin_ctz(mask);
+            return i < count ? i : count;
+        }
+        from += 16;
+    }
+#endif
+    for (; from < count; from++) {
+        if (fps[from] == fp)
+            return from;
+    }
+    return count;
+}
+
+}  // namespace
+
+/*
+ * Range is halved without branches until HEAD_WINDOW heads are left,
+ * those are compared 2 at once with SSE4.2. Sign bit is flipped as
+ * SSE comparison is signed.
+ */
+uint64_t pmseCountHeadsLess(const uint64_t* heads, uint64_t count, uint64_t head) {
+    const uint64_t* base = heads;
+    while (count > HEAD_WINDOW) {
+        uint64_t half = count / 2;
+        base = base[half - 1] < head ? base + half : base;
+        count -= half;
+    }
+    uint64_t i = 0;
+#if defined(__SSE4_2__)
+    const __m128i bias = _mm_set1_epi64x(std::numeric_limits<int64_t>::min());
+    const __m128i needle = _mm_xor_si128(_mm_set1_epi64x(head), bias);
+    for (; i + 2 <= count; i += 2) {
+        __m128i chunk = _mm_xor_si128(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + i)), bias);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(needle, chunk)));
+        if (mask != 3)
+            return (base - heads) + i + (mask & 1);
+    }
+#endif
+    while (i < count && base[i] < head)
+        i++;
+    return (base - heads) + i;
+}
+
+/*
+ * Keys equal in index ordering have equal encoding, so bytes are hashed.
+ */
+uint8_t pmseKeyFingerprint(StringData key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.size(); i++) {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<uint8_t>(hash ^ (hash >> 8) ^ (hash >> 32));
+}
+
+PmseLeafComparator::PmseLeafComparator(StringData key, StringData prefix) {
+    size_t common = std::min(key.size(), prefix.size());
+    int x = memcmp(key.rawData(), prefix.rawData(), common);
+    if (x != 0)
+        _prefixResult = x < 0 ? -1 : 1;
+    else if (key.size() < prefix.size())
+        _prefixResult = -1;
+    else {
+        _rest = key.substr(prefix.size());
+        _restHead = pmseKeyHead(_rest);
+    }
+}
+
+template <uint64_t ORDER>
+std::string PmseTreeImpl<ORDER>::leafKeyString(NodePtr leaf, uint64_t index) {
+    std::string key;
+    if (leaf->prefixSize > 0)
+        key = leaf->prefix.key().toString();
+    StringData suffix = leafSuffix(leaf, index);
+    key.append(suffix.rawData(), suffix.size());
+    return key;
+}
+
+template <uint64_t ORDER>
+BSONObj PmseTreeImpl<ORDER>::decodeKey(StringData key, StringData typeBits) const {
+    return KeyString::toBson(key.rawData(), key.size(), _keyOrdering,
+                             decodeTypeBits(typeBits));
+}
+
+template <uint64_t ORDER>
+PmseLeafComparator PmseTreeImpl<ORDER>::leafComparator(StringData key, NodePtr leaf) {
+    return PmseLeafComparator(key, leaf->prefixSize ? leaf->prefix.key() : StringData());
+}
+
+template <uint64_t ORDER>
+int PmseTreeImpl<ORDER>::compareLeafKey(StringData key, NodePtr leaf, uint64_t index) {
+    uint64_t slot = slotOf(leaf, index);
+    return leafComparator(key, leaf).compare(leaf->heads[slot], leaf->keys[slot].key());
+}
+
+/*
+ * Sorted leaf is binary searched. Unsorted leaf is scanned in key order,
+ * keys with other head than key's aren't read.
+ */
+template <uint64_t ORDER>
+uint64_t PmseTreeImpl<ORDER>::leafLowerBound(NodePtr leaf, StringData key, int& cmp) {
+    PmseLeafComparator leafCmp = leafComparator(key, leaf);
+    uint64_t count = leaf->num_keys;
+    uint64_t i = 0;
+
+    if (!leafCmp.prefixMatches()) {
+        cmp = leafCmp.compare(StringData());
+        return cmp > 0 ? count : 0;
+    }
+    if (!_unsorted) {
+        return pmseLowerBound(reinterpret_cast<const uint64_t*>(leaf->heads), count,
+                              leafCmp.rest(), leafCmp.head(),
+                              [&](uint64_t index) { return leaf->keys[index].key(); }, cmp);
+    }
+    cmp = 1;
+    for (; i < count; i++) {
+        uint64_t slot = slotOf(leaf, i);
+        cmp = leafCmp.compare(leaf->heads[slot], leaf->keys[slot].key());
+        if (cmp <= 0)
+            break;
+    }
+    return i;
+}
+
+/*
+ * Key must start with prefix of leaf, see fitLeafPrefix().
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::setLeafKey(NodePtr leaf, uint64_t index, StringData key,
+                                     StringData typeBits) {
+    uint64_t slot = slotOf(leaf, index);
+    StringData suffix = key.substr(leaf->prefixSize);
+    leaf->keys[slot].assign(suffix, typeBits);
+    leaf->heads[slot] = pmseKeyHead(suffix);
+}
+
+/*
+ * Shortens prefix of leaf so key can be stored in it.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::fitLeafPrefix(NodePtr leaf, StringData key) {
+    uint64_t size = leaf->prefixSize;
+    if (size == 0)
+        return;
+    uint64_t common = commonBytes(leaf->prefix.key(), key, size);
+    if (common < size)
+        setLeafPrefix(leaf, common);
+}
+
+/*
+ * Extends prefix of leaf with bytes its suffixes have in common,
+ * done when leaf is split.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::rebuildLeafPrefix(NodePtr leaf) {
+    if (leaf->num_keys < 2)
+        return;
+    StringData first = leafSuffix(leaf, 0);
+    uint64_t extra = first.size();
+    for (uint64_t i = 1; i < leaf->num_keys && extra > 0; i++)
+        extra = commonBytes(first, leafSuffix(leaf, i), extra);
+    if (extra > 0)
+        setLeafPrefix(leaf, leaf->prefixSize + extra);
+}
+
+/*
+ * Stores all keys of leaf again with prefix of given length.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::setLeafPrefix(NodePtr leaf, uint64_t size) {
+    std::vector<std::string> keys;
+    std::vector<std::string> typeBits;
+    keys.reserve(leaf->num_keys);
+    typeBits.reserve(leaf->num_keys);
+    for (uint64_t i = 0; i < leaf->num_keys; i++) {
+        keys.push_back(leafKeyString(leaf, i));
+        typeBits.push_back(leafTypeBits(leaf, i).toString());
+    }
+    retireLeafKeys(leaf);
+    leaf->prefixSize = size;
+    if (size > 0)
+        leaf->prefix.assign(StringData(keys[0]).substr(0, size), StringData());
+    for (uint64_t i = 0; i < leaf->num_keys; i++)
+        setLeafKey(leaf, i, keys[i], typeBits[i]);
+}
+
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::retireLeafKeys(NodePtr leaf) {
+    for (uint64_t i = 0; i < leaf->num_keys; i++)
+        leaf->keys[slotOf(leaf, i)].retire(_tree->_limbo);
+    if (leaf->prefixSize > 0)
+        leaf->prefix.retire(_tree->_limbo);
+}
+
+template <uint64_t ORDER>
+uint64_t PmseTreeImpl<ORDER>::indexOfSlot(NodePtr leaf, uint64_t slot) {
+    uint64_t i = 0;
+    while (i < leaf->num_keys && leaf->slotOrder[i] != slot)
+        i++;
+    return i;
+}
+
+/*
+ * Stores key as index-th key of unsorted leaf. Key goes to free slot,
+ * which is flushed without being logged as no key refers to it yet;
+ * only slot order and one bitmap word are snapshotted.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::insertSlot(NodePtr leaf, uint64_t index, StringData key,
+                                     StringData typeBits, const RecordId& loc) {
+    uint64_t count = leaf->num_keys;
+    uint64_t slot = leaf->slotOrder[count];
+    StringData suffix = key.substr(leaf->prefixSize);
+    leaf->keys[slot].assignUnlogged(suffix, typeBits);
+    const_cast<uint64_t&>(leaf->heads[slot].get_ro()) = pmseKeyHead(suffix);
+    const_cast<RecordId&>(leaf->values_array[slot].get_ro()) = loc;
+    const_cast<uint8_t&>(leaf->fingerprints[slot].get_ro()) = pmseKeyFingerprint(key);
+    _pop.persist(&leaf->keys[slot], sizeof(leaf->keys[slot]));
+    _pop.persist(&leaf->heads[slot], sizeof(leaf->heads[slot]));
+    _pop.persist(&leaf->values_array[slot], sizeof(leaf->values_array[slot]));
+    _pop.persist(&leaf->fingerprints[slot], sizeof(leaf->fingerprints[slot]));
+
+    pmemobj_tx_add_range_direct(&leaf->slotOrder[index], count - index + 1);
+    memmove(&leaf->slotOrder[index + 1], &leaf->slotOrder[index], count - index);
+    leaf->slotOrder[index] = slot;
+    leaf->slotBitmap[slot / 64] = leaf->slotBitmap[slot / 64] | (1ULL << (slot % 64));
+    leaf->num_keys = count + 1;
+}
+
+/*
+ * Inserts key into latched unsorted leaf without undo log. Key goes to
+ * free slot, then slot order and key count are updated in place and
+ * slot bit is set last; each step is persisted before next one. Crash
+ * before bit is set leaves order not matching bitmap, repairLeafSlots()
+ * restores it when index is opened. Returns false when key needs out
+ * of line copy or shorter leaf prefix, these go through transaction.
+ * Leaf must not be changed by enclosing transaction.
+ */
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::publishSlot(NodePtr leaf, StringData key, StringData typeBits,
+                                      const RecordId& loc) {
+    uint64_t prefixSize = leaf->prefixSize;
+    if (prefixSize > 0 && commonBytes(leaf->prefix.key(), key, prefixSize) < prefixSize)
+        return false;
+    StringData suffix = key.substr(prefixSize);
+    if (suffix.size() + typeBits.size() > static_cast<uint64_t>(TREE_INLINE_KEY_SIZE))
+        return false;
+
+    int cmp;
+    uint64_t index = leafLowerBound(leaf, key, cmp);
+    uint64_t count = leaf->num_keys;
+    uint64_t slot = leaf->slotOrder[count];
+    leaf->keys[slot].assignUnlogged(suffix, typeBits);
+    const_cast<uint64_t&>(leaf->heads[slot].get_ro()) = pmseKeyHead(suffix);
+    const_cast<RecordId&>(leaf->values_array[slot].get_ro()) = loc;
+    const_cast<uint8_t&>(leaf->fingerprints[slot].get_ro()) = pmseKeyFingerprint(key);
+    _pop.flush(&leaf->keys[slot], sizeof(leaf->keys[slot]));
+    _pop.flush(&leaf->heads[slot], sizeof(leaf->heads[slot]));
+    _pop.flush(&leaf->values_array[slot], sizeof(leaf->values_array[slot]));
+    _pop.persist(&leaf->fingerprints[slot], sizeof(leaf->fingerprints[slot]));
+
+    memmove(&leaf->slotOrder[index + 1], &leaf->slotOrder[index], count - index);
+    leaf->slotOrder[index] = slot;
+    const_cast<uint64_t&>(leaf->num_keys.get_ro()) = count + 1;
+    _pop.flush(&leaf->slotOrder[index], count - index + 1);
+    _pop.persist(&leaf->num_keys, sizeof(leaf->num_keys));
+
+    uint64_t& word = const_cast<uint64_t&>(leaf->slotBitmap[slot / 64].get_ro());
+    word |= 1ULL << (slot % 64);
+    _pop.persist(&word, sizeof(word));
+    return true;
+}
+
+/*
+ * True when first num_keys entries of slot order are exactly the slots
+ * marked used in bitmap.
+ */
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::leafSlotsConsistent(NodePtr leaf) {
+    uint64_t count = leaf->num_keys;
+    if (count > ORDER)
+        return false;
+    uint64_t seen[(ORDER + 63) / 64] = {};
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t slot = leaf->slotOrder[i];
+        if (slot >= ORDER || (seen[slot / 64] & (1ULL << (slot % 64))))
+            return false;
+        seen[slot / 64] |= 1ULL << (slot % 64);
+    }
+    for (uint64_t w = 0; w < (ORDER + 63) / 64; w++) {
+        if (seen[w] != leaf->slotBitmap[w])
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Rebuilds slot order of unsorted leaves interrupted by crash in
+ * publishSlot(), from slots marked used in bitmap.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::repairLeafSlots() {
+    uint64_t repaired = 0;
+    for (NodePtr leaf = first(); leaf != nullptr; leaf = leaf->next) {
+        if (leafSlotsConsistent(leaf))
+            continue;
+        std::vector<uint8_t> used;
+        std::vector<uint8_t> free;
+        for (uint64_t slot = 0; slot < ORDER; slot++) {
+            if (leaf->slotBitmap[slot / 64] & (1ULL << (slot % 64)))
+                used.push_back(slot);
+            else
+                free.push_back(slot);
+        }
+        std::sort(used.begin(), used.end(), [&](uint8_t a, uint8_t b) {
+            return leaf->keys[a].key().compare(leaf->keys[b].key()) < 0;
+        });
+        transaction::exec_tx(_pop, [&] {
+            pmemobj_tx_add_range_direct(leaf->slotOrder, sizeof(leaf->slotOrder));
+            std::copy(used.begin(), used.end(), leaf->slotOrder);
+            std::copy(free.begin(), free.end(), leaf->slotOrder + used.size());
+            leaf->num_keys = used.size();
+        });
+        repaired++;
+    }
+    if (repaired)
+        log() << "Repaired slot order of " << repaired << " index leaves";
+}
+
+/*
+ * Drops index-th key of unsorted leaf, its slot becomes first free one.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::removeSlot(NodePtr leaf, uint64_t index) {
+    uint64_t count = leaf->num_keys;
+    uint64_t slot = leaf->slotOrder[index];
+    leaf->keys[slot].retire(_tree->_limbo);
+    pmemobj_tx_add_range_direct(&leaf->slotOrder[index], count - index);
+    memmove(&leaf->slotOrder[index], &leaf->slotOrder[index + 1], count - index - 1);
+    leaf->slotOrder[count - 1] = slot;
+    leaf->slotBitmap[slot / 64] = leaf->slotBitmap[slot / 64] & ~(1ULL << (slot % 64));
+    leaf->num_keys = count - 1;
+}
+
+/*
+ * Moves keys of unsorted leaf to slots matching their order, so code
+ * moving keys between leaves can work on slots directly.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::compactLeaf(NodePtr leaf) {
+    if (!_unsorted)
+        return;
+    uint64_t i = 0;
+    while (i < ORDER && leaf->slotOrder[i] == i)
+        i++;
+    if (i == ORDER)
+        return;
+    PmseKey temp_keys_array[ORDER];
+    uint64_t temp_heads[ORDER];
+    RecordId temp_values_array[ORDER];
+    uint8_t temp_fingerprints[ORDER];
+    for (i = 0; i < leaf->num_keys; i++) {
+        uint64_t slot = leaf->slotOrder[i];
+        temp_keys_array[i] = leaf->keys[slot];
+        temp_heads[i] = leaf->heads[slot];
+        temp_values_array[i] = leaf->values_array[slot];
+        temp_fingerprints[i] = leaf->fingerprints[slot];
+    }
+    for (i = 0; i < leaf->num_keys; i++) {
+        leaf->keys[i] = temp_keys_array[i];
+        leaf->heads[i] = temp_heads[i];
+        leaf->values_array[i] = temp_values_array[i];
+        leaf->fingerprints[i] = temp_fingerprints[i];
+    }
+    resetLeafSlots(leaf);
+}
+
+/*
+ * Marks first num_keys slots of unsorted leaf used, in their order.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::resetLeafSlots(NodePtr leaf) {
+    if (!_unsorted)
+        return;
+    pmemobj_tx_add_range_direct(leaf->slotOrder, sizeof(leaf->slotOrder));
+    for (uint64_t i = 0; i < ORDER; i++)
+        leaf->slotOrder[i] = i;
+    for (uint64_t w = 0; w < (ORDER + 63) / 64; w++) {
+        uint64_t used = leaf->num_keys > w * 64 ? leaf->num_keys - w * 64 : 0;
+        leaf->slotBitmap[w] = used >= 64 ? ~0ULL : (1ULL << used) - 1;
+    }
+}
+
+/*
+ * Next slot of leaf from given one with key equal to key, or num_keys.
+ */
+template <uint64_t ORDER>
+uint64_t PmseTreeImpl<ORDER>::findEqual(NodePtr leaf, uint64_t from, StringData key,
+                                        uint8_t fingerprint) {
+    PmseLeafComparator leafCmp = leafComparator(key, leaf);
+    if (!leafCmp.prefixMatches())
+        return leaf->num_keys;
+    const uint8_t* fps = reinterpret_cast<const uint8_t*>(leaf->fingerprints);
+    if (_unsorted) {
+        /* Fingerprints of used slots are scanned, first equal key in order wins */
+        uint64_t found = leaf->num_keys;
+        for (uint64_t slot = findFingerprint(fps, ORDER, 0, ORDER, fingerprint);
+             slot < ORDER;
+             slot = findFingerprint(fps, ORDER, slot + 1, ORDER, fingerprint)) {
+            if ((leaf->slotBitmap[slot / 64] & (1ULL << (slot % 64))) == 0
+                            || leafCmp.compare(leaf->keys[slot].key()) != 0)
+                continue;
+            uint64_t i = indexOfSlot(leaf, slot);
+            if (i >= from && i < found)
+                found = i;
+        }
+        return found;
+    }
+    for (uint64_t i = findFingerprint(fps, ORDER, from, leaf->num_keys, fingerprint);
+         i < leaf->num_keys;
+         i = findFingerprint(fps, ORDER, i + 1, leaf->num_keys, fingerprint)) {
+        if (leafCmp.compare(leaf->keys[i].key()) == 0)
+            return i;
+    }
+    return leaf->num_keys;
+}
+
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::equalAt(NodePtr leaf, uint64_t index, StringData key,
+                                  uint8_t fingerprint) {
+    return leaf->fingerprints[slotOf(leaf, index)] == fingerprint
+                    && compareLeafKey(key, leaf, index) == 0;
+}
+
+/*
+ * Run of keys equal to key starts at lower bound in its leaf or in
+ * previous leaves, and may continue in next ones. Entry with record loc
+ * is searched in it, first entry if loc is null. Leaves are read without
+ * latches, search is repeated if any of them changed meanwhile.
+ */
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::findEntry(StringData key, const RecordId& loc,
+                                    CursorObject<ORDER>& found) {
+    PmseLatchTable& table = _latches;
+    std::vector<std::pair<NodePtr, uint64_t>> seen;
+    auto visit = [&](NodePtr node) {
+        if (node != nullptr)
+            seen.emplace_back(node, table.readBegin(node.get()));
+        return node;
+    };
+    auto search = [&](NodePtr leaf) {
+        int cmp;
+        uint64_t start = leafLowerBound(leaf, key, cmp);
+
+        NodePtr node = leaf;
+        uint64_t i = start;
+        while (true) {
+            while (i == 0 && node != nullptr) {
+                node = visit(node->previous);
+                i = node != nullptr ? std::min<uint64_t>(node->num_keys, ORDER) : 0;
             }
-            /*
-             * This should be removed
-             */
-            key_record = node->values_array[i];
+            if (node == nullptr || compareLeafKey(key, node, --i) != 0)
+                break;
+            if (loc.isNull() || leafValue(node, i) == loc) {
+                found.node = node;
+                found.index = i;
+                return true;
+            }
+        }
+
+        node = leaf;
+        i = start;
+        while (true) {
+            while (node != nullptr && i >= node->num_keys) {
+                node = visit(node->next);
+                i = 0;
+            }
+            if (node == nullptr || compareLeafKey(key, node, i) != 0)
+                break;
+            if (loc.isNull() || leafValue(node, i) == loc) {
+                found.node = node;
+                found.index = i;
+                return true;
+            }
+            i++;
+        }
+        return false;
+    };
+
+    while (true) {
+        uint64_t version;
+        NodePtr leaf = findLeaf(key, version);
+        if (leaf == nullptr)
+            return false;
+        seen.assign(1, std::make_pair(leaf, version));
+        bool result = search(leaf);
+        if (std::all_of(seen.begin(), seen.end(), [&](const std::pair<NodePtr, uint64_t>& n) {
+                            return table.validate(n.first.get(), n.second);
+                        }))
+            return result;
+    }
+}
+
+/*
+ * Entry of key for loc in leaf, found in run of equal keys starting at
+ * lower bound. First entry of key if loc is null.
+ */
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::findEntryInLeaf(NodePtr leaf, StringData key, const RecordId& loc,
+                                          uint64_t& index) {
+    int cmp;
+    for (index = leafLowerBound(leaf, key, cmp);
+         index < leaf->num_keys && compareLeafKey(key, leaf, index) == 0; index++) {
+        if (loc.isNull() || leafValue(leaf, index) == loc)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Neighbor leaves aren't latched, emptied one is skipped.
+ */
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::duplicateIn(NodePtr leaf, StringData key, const RecordId& loc) {
+    uint8_t fp = pmseKeyFingerprint(key);
+    for (uint64_t i = findEqual(leaf, 0, key, fp); i < leaf->num_keys;
+         i = findEqual(leaf, i + 1, key, fp)) {
+        if (leafValue(leaf, i) != loc)
+            return true;
+    }
+    NodePtr prev = leaf->previous;
+    if (prev != nullptr && prev->num_keys > 0 && equalAt(prev, prev->num_keys - 1, key, fp)
+                    && leafValue(prev, prev->num_keys - 1) != loc)
+        return true;
+    NodePtr next = leaf->next;
+    if (next != nullptr && next->num_keys > 0 && equalAt(next, 0, key, fp)
+                    && leafValue(next, 0) != loc)
+        return true;
+    return false;
+}
+
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::hasDuplicate(const BSONObj& bsonKey, const RecordId& loc) {
+    std::string key = encodeKey(bsonKey);
+    while (true) {
+        uint64_t version;
+        NodePtr leaf = findLeaf(key, version);
+        if (leaf == nullptr)
+            return false;
+        bool found = duplicateIn(leaf, key, loc);
+        if (_latches.validate(leaf.get(), version))
+            return found;
+    }
+}
+
+/*
+ * Optimistic lock coupling: version of child is read before parent is
+ * validated, so child reached from unchanged parent was still linked
+ * when its version was read. Search restarts if any node changed.
+ * DRAM inner nodes are searched under shared latch instead.
+ */
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::findLeaf(StringData key, uint64_t& version) {
+    PmseLatchTable& table = _latches;
+    if (_volatileInner) {
+        while (true) {
+            _innerLatch.lockShared();
+            PmseTreeNode<ORDER>* leaf = _inner.findLeaf(key);
+            bool stable = leaf == nullptr || table.tryReadBegin(leaf, version);
+            _innerLatch.unlockShared();
+            if (stable)
+                return leaf ? NodePtr(pmemobj_oid(leaf)) : nullptr;
+            std::this_thread::yield();
+        }
+    }
+
+    uint64_t head = pmseKeyHead(key);
+    while (true) {
+        uint64_t anchorVersion = table.readBegin(anchor());
+        NodePtr node = root();
+        if (node == nullptr) {
+            if (table.validate(anchor(), anchorVersion))
+                return nullptr;
+            continue;
+        }
+        version = table.readBegin(node.get());
+        if (!table.validate(anchor(), anchorVersion))
+            continue;
+        bool wasEqual = false;
+        while (node != nullptr && !node->is_leaf) {
+            NodePtr child = node->children_array[childIndex(node, key, head, wasEqual)];
+            uint64_t childVersion = child != nullptr ? table.readBegin(child.get()) : 0;
+            if (!table.validate(node.get(), version))
+                child = nullptr;
+            node = child;
+            version = childVersion;
+        }
+        if (node != nullptr)
+            return node;
+    }
+}
+
+/*
+ * Leaf chain is walked once, first keys of leaves are read from pool
+ * by worker threads.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::rebuildInnerNodes() {
+    std::vector<NodePtr> chain;
+    for (NodePtr leaf = first(); leaf != nullptr; leaf = leaf->next)
+        chain.push_back(leaf);
+    std::vector<PmseTreeNode<ORDER>*> leaves(chain.size());
+    std::vector<std::string> separators(chain.empty() ? 0 : chain.size() - 1);
+    parallelForRanges(chain.size(), pmseWorkerThreads(),
+                      [&](uint64_t begin, uint64_t end) {
+        for (uint64_t i = begin; i < end; i++) {
+            leaves[i] = chain[i].get();
+            if (i > 0)
+                separators[i - 1] = leafKeyString(chain[i], 0);
+        }
+    });
+    _inner.build(leaves, separators);
+}
+
+/*
+ * With inner nodes in DRAM leaves aren't merged, empty leaf is taken
+ * out of chain. Inner nodes drop it once transaction commits, until
+ * then readers reaching it wait for its latch.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::unlinkLeaf(NodePtr leaf, PmseLatchSet& latches) {
+    NodePtr prev = leaf->previous;
+    NodePtr next = leaf->next;
+    if (prev)
+        prev->next = next;
+    else
+        _tree->first = next.raw();
+    if (next)
+        next->previous = prev;
+    else
+        setLast(prev);
+    retireLeafKeys(leaf);
+    PmseTreeNode<ORDER>* node = leaf.get();
+    latches.afterCommit([this, node] {
+        _innerLatch.lock();
+        _inner.removeLeaf(node);
+        _innerLatch.unlock();
+    });
+    _tree->_limbo.retire(leaf.raw());
+}
+
+template <uint64_t ORDER>
+std::unique_ptr<SortedDataInterface::Cursor> PmseTreeImpl<ORDER>::newCursor(
+                OperationContext* txn, bool isForward) {
+    return stdx::make_unique<PmseCursor<ORDER>>(txn, isForward, this);
+}
+
+/*
+ * Read internal nodes with their keys, subtrees of root
+ * are walked by worker threads. Returns number of touched nodes.
+ */
+template <uint64_t ORDER>
+uint64_t PmseTreeImpl<ORDER>::prefaultInnerNodes() {
+    NodePtr root = this->root();
+    if (root == nullptr || root->is_leaf)
+        return 0;
+    std::atomic<uint64_t> nodes{1};
+    prefaultObject(root.get(), sizeof(PmseTreeNode<ORDER>));
+    parallelForRanges(root->num_keys + 1, pmseWorkerThreads(),
+                      [&](uint64_t begin, uint64_t end) {
+        for (uint64_t i = begin; i < end; i++)
+            nodes += prefaultSubtree(root->children_array[i]);
+    });
+    return nodes;
+}
+
+template <uint64_t ORDER>
+uint64_t PmseTreeImpl<ORDER>::prefaultSubtree(NodePtr node) {
+    if (node == nullptr || node->is_leaf)
+        return 0;
+    uint64_t nodes = 1;
+    prefaultObject(node.get(), sizeof(PmseTreeNode<ORDER>));
+    for (uint64_t i = 0; i < node->num_keys; i++) {
+        if (node->keys[i].data)
+            prefaultObject(node->keys[i].data.get(), BSON_MIN_SIZE);
+    }
+    for (uint64_t i = 0; i <= node->num_keys; i++) {
+        nodes += prefaultSubtree(node->children_array[i]);
+    }
+    return nodes;
+}
+
+/*
+ * Entry of key for loc is removed. Unique index has one entry of key,
+ * it's removed whatever its record is. Leaf which keeps enough keys is
+ * changed with only itself latched, it must still have version seen on
+ * the way down. Otherwise nodes are merged under structure mutex.
+ */
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::remove(const BSONObj& bsonKey, const RecordId& loc,
+                                 bool dupsAllowed, PmseLatchSet& latches) {
+    CursorObject<ORDER> found;
+    std::string key = encodeKey(bsonKey);
+    RecordId wanted = dupsAllowed ? loc : RecordId();
+
+    while (true) {
+        uint64_t version;
+        NodePtr leaf = findLeaf(key, version);
+        if (leaf == nullptr)
+            return false;
+        if (!removalStaysInLeaf(leaf))
             break;
+        if (!latches.tryUpgrade(leaf.get(), version))
+            continue;
+        uint64_t index;
+        if (findEntryInLeaf(leaf, key, wanted, index)) {
+            removeEntryFromNode(leaf, index);
+            return true;
         }
+        /* Entry is in other leaf of run, or missing */
+        latches.release();
+        break;
     }
 
-    /*
-     * Remove value
-     */
+    while (true) {
+        latches.lockStructure(_structureMutex);
+        if (!findEntry(key, wanted, found))
+            return false;
+        latches.lock(found.node.get());
+        if (found.index < found.node->num_keys
+                        && compareLeafKey(key, found.node, found.index) == 0
+                        && (wanted.isNull() || leafValue(found.node, found.index) == wanted))
+            break;
+        latches.release();
+    }
+    latchRemoval(found.node, latches);
+    if (_volatileInner) {
+        NodePtr leaf = removeEntryFromNode(found.node, found.index);
+        if (leaf->num_keys == 0)
+            unlinkLeaf(leaf, latches);
+        return true;
+    }
+    setRoot(deleteEntry(found.node, found.index));
+    return true;
+}
 
-    root = deleteEntry(pop, key, node, i);
+/* True if removing one key of leaf changes no other node */
+template <uint64_t ORDER>
+bool PmseTreeImpl<ORDER>::removalStaysInLeaf(NodePtr leaf) {
+    uint64_t count = leaf->num_keys;
+    if (count < 2)
+        return false;
+    return _volatileInner || leaf == root() || count - 1 >= cut(ORDER - 1);
 }
 
-persistent_ptr<PmseTreeNode> PmseTree::deleteEntry(
-                pool_base pop, BSONObj& key, persistent_ptr<PmseTreeNode> node,
-                uint64_t index) {
+/*
+ * Latches nodes removal of key from leaf changes, before anything is
+ * changed, following deleteEntry(): nodes falling below minimum, their
+ * parents and neighbors they are merged with or borrow from, leaf after
+ * merged ones, and anchor if root, first or last node changes.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::latchRemoval(NodePtr leaf, PmseLatchSet& latches) {
+    latches.lock(leaf.get());
+    if (_volatileInner) {
+        if (leaf->num_keys == 1) {
+            latchOrAnchor(leaf->previous, latches);
+            latchOrAnchor(leaf->next, latches);
+        }
+        return;
+    }
+
+    NodePtr root = this->root();
+    for (NodePtr node = leaf;; node = node->parent) {
+        latches.lock(node.get());
+        if (node == root) {
+            if (node->num_keys == 1)
+                latches.lock(anchor());
+            return;
+        }
+        uint64_t min_keys = node->is_leaf ? cut(ORDER - 1) : cut(ORDER) - 1;
+        if (node->num_keys - 1 >= min_keys)
+            return;
+        int64_t neighbor_index = getNeighborIndex(node);
+        NodePtr neighbor = node->parent->children_array[neighbor_index == -1 ? 1 : neighbor_index];
+        latches.lock(node->parent.get());
+        latches.lock(neighbor.get());
+        uint64_t capacity = node->is_leaf ? ORDER : ORDER - 1;
+        if (neighbor->num_keys + node->num_keys - 1 >= capacity)
+            return;
+        if (node->is_leaf)
+            latchOrAnchor(neighbor_index == -1 ? neighbor->next : node->next, latches);
+    }
+}
+
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::deleteEntry(NodePtr node, uint64_t index) {
     uint64_t min_keys;
     int64_t neighbor_index;
     int64_t k_prime_index;
-    BSONObj_PM k_prime;
+    PmseKey k_prime;
     uint64_t capacity;
-    persistent_ptr<PmseTreeNode> neighbor;
+    NodePtr neighbor;
+    NodePtr root = this->root();
 
     // Remove key and pointer from node.
 
-    node = removeEntryFromNode(key, node, index);
-    modified = true;
+    node = removeEntryFromNode(node, index);
 
     if (node == root) {
         return adjustRoot(root);
@@ -124,7 +971,7 @@ persistent_ptr<PmseTreeNode> PmseTree::deleteEntry(
     /* Determine minimum allowable size of node,
      * to be preserved after deletion.
      */
-    min_keys = node->is_leaf ? cut(TREE_ORDER - 1) : cut(TREE_ORDER) - 1;
+    min_keys = node->is_leaf ? cut(ORDER - 1) : cut(ORDER) - 1;
     /* Case:  node stays at or above minimum.
      * (The simple case.)
      */
@@ -150,14 +997,18 @@ persistent_ptr<PmseTreeNode> PmseTree::deleteEntry(
                     node->parent->children_array[1] :
                     node->parent->children_array[neighbor_index];
 
-    capacity = node->is_leaf ? TREE_ORDER : TREE_ORDER - 1;
+    capacity = node->is_leaf ? ORDER : ORDER - 1;
+    if (node->is_leaf) {
+        compactLeaf(node);
+        compactLeaf(neighbor);
+    }
     /* Coalescence. */
 
     if (neighbor->num_keys + node->num_keys < capacity)
-        return coalesceNodes(pop, root, node, neighbor, neighbor_index, k_prime);
+        return coalesceNodes(root, node, neighbor, neighbor_index, k_prime);
 
     else
-        return redistributeNodes(pop, root, node, neighbor, neighbor_index,
+        return redistributeNodes(root, node, neighbor, neighbor_index,
                         k_prime_index, k_prime);
 }
 
@@ -167,14 +1018,15 @@ persistent_ptr<PmseTreeNode> PmseTree::deleteEntry(
  * small node's entries without exceeding the
  * maximum
  */
-persistent_ptr<PmseTreeNode> PmseTree::redistributeNodes(
-                pool_base pop, persistent_ptr<PmseTreeNode> root,
-                persistent_ptr<PmseTreeNode> n,
-                persistent_ptr<PmseTreeNode> neighbor, int64_t neighbor_index,
-                int64_t k_prime_index, BSONObj_PM k_prime) {
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::redistributeNodes(
+                NodePtr root, NodePtr n, NodePtr neighbor, int64_t neighbor_index,
+                int64_t k_prime_index, PmseKey k_prime) {
 
     uint64_t i;
-    persistent_ptr<PmseTreeNode> tmp;
+    NodePtr tmp;
+    std::string movedKey;
+    std::string movedBits;
 
     /* Case: n has a neighbor to the left.
      * Pull the neighbor's last key-pointer pair over
@@ -185,12 +1037,18 @@ persistent_ptr<PmseTreeNode> PmseTree::redistributeNodes(
             n->children_array[n->num_keys + 1] = n->children_array[n->num_keys];
             for (i = n->num_keys; i > 0; i--) {
                 n->keys[i] = n->keys[i - 1];
+                n->heads[i] = n->heads[i - 1];
                 n->children_array[i] = n->children_array[i - 1];
             }
         } else {
+            movedKey = leafKeyString(neighbor, neighbor->num_keys - 1);
+            movedBits = leafTypeBits(neighbor, neighbor->num_keys - 1).toString();
+            fitLeafPrefix(n, movedKey);
             for (i = n->num_keys; i > 0; i--) {
                 n->keys[i] = n->keys[i - 1];
+                n->heads[i] = n->heads[i - 1];
                 n->values_array[i] = n->values_array[i - 1];
+                n->fingerprints[i] = n->fingerprints[i - 1];
             }
         }
         if (!n->is_leaf) {
@@ -199,27 +1057,23 @@ persistent_ptr<PmseTreeNode> PmseTree::redistributeNodes(
             tmp->parent = n;
             neighbor->children_array[neighbor->num_keys] = nullptr;
             n->keys[0] = k_prime;
-            n->parent->keys[k_prime_index].data =
-                            neighbor->keys[neighbor->num_keys - 1].data;
+            n->heads[0] = pmseKeyHead(k_prime.key());
+            n->parent->keys[k_prime_index] =
+                            neighbor->keys[neighbor->num_keys - 1];
+            n->parent->heads[k_prime_index] = neighbor->heads[neighbor->num_keys - 1];
         } else {
             n->values_array[0] = neighbor->values_array[neighbor->num_keys - 1];
-            n->keys[0] = neighbor->keys[neighbor->num_keys - 1];
+            n->fingerprints[0] = neighbor->fingerprints[neighbor->num_keys - 1];
+            setLeafKey(n, 0, movedKey, movedBits);
+            neighbor->keys[neighbor->num_keys - 1].retire(_tree->_limbo);
 
-            BSONObj_PM bsonPM;
-            persistent_ptr<char> obj;
-            transaction::exec_tx(pop,
+            transaction::exec_tx(_pop,
                             [&] {
-                                obj = pmemobj_tx_alloc(n->keys[0].getBSON().objsize(), 1);
-                                memcpy( (void*)obj.get(), n->keys[0].getBSON().objdata(), n->keys[0].getBSON().objsize());
+                                n->parent->keys[k_prime_index].retire(_tree->_limbo);
+                                n->parent->keys[k_prime_index].assign(movedKey, StringData());
+                                n->parent->heads[k_prime_index] = pmseKeyHead(movedKey);
                             });
 
-            bsonPM = (n->parent->keys[k_prime_index]);
-            if (bsonPM.data.raw().off != 0)
-                pmemobj_tx_free(bsonPM.data.raw());
-
-            bsonPM.data = obj;
-            n->parent->keys[k_prime_index].data = bsonPM.data;
-
         }
     }
 
@@ -231,45 +1085,44 @@ persistent_ptr<PmseTreeNode> PmseTree::redistributeNodes(
 
     else {
         if (n->is_leaf) {
-            n->keys[n->num_keys] = neighbor->keys[0];
+            movedKey = leafKeyString(neighbor, 0);
+            movedBits = leafTypeBits(neighbor, 0).toString();
+            fitLeafPrefix(n, movedKey);
+            setLeafKey(n, n->num_keys, movedKey, movedBits);
             n->values_array[n->num_keys] = neighbor->values_array[0];
+            n->fingerprints[n->num_keys] = neighbor->fingerprints[0];
+            neighbor->keys[0].retire(_tree->_limbo);
+            std::string separator = leafKeyString(neighbor, 1);
 
-            BSONObj_PM bsonPM;
-            persistent_ptr<char> obj;
-            transaction::exec_tx(pop,
+            transaction::exec_tx(_pop,
                             [&] {
-                                obj = pmemobj_tx_alloc(neighbor->keys[1].getBSON().objsize(), 1);
-                                memcpy( (void*)obj.get(), neighbor->keys[1].getBSON().objdata(), neighbor->keys[1].getBSON().objsize());
+                                n->parent->keys[k_prime_index].retire(_tree->_limbo);
+                                n->parent->keys[k_prime_index].assign(separator, StringData());
+                                n->parent->heads[k_prime_index] = pmseKeyHead(separator);
                             });
-
-            bsonPM = (n->parent->keys[k_prime_index]);
-            if (bsonPM.data.raw().off != 0)
-                pmemobj_tx_free(bsonPM.data.raw());
-
-            bsonPM.data = obj;
-
-            n->parent->keys[k_prime_index].data = bsonPM.data;
         } else {
             n->keys[n->num_keys] = k_prime;
+            n->heads[n->num_keys] = pmseKeyHead(k_prime.key());
             n->children_array[n->num_keys + 1] = neighbor->children_array[0];
             tmp = n->children_array[n->num_keys + 1];
             tmp->parent = n;
 
-            BSONObj_PM bsonPM;
-            bsonPM = (n->parent->keys[k_prime_index]);
-
-            n->parent->keys[k_prime_index].data = neighbor->keys[0].data;
+            n->parent->keys[k_prime_index] = neighbor->keys[0];
+            n->parent->heads[k_prime_index] = neighbor->heads[0];
         }
         if (!n->is_leaf) {
             for (i = 0; i < neighbor->num_keys - 1; i++) {
                 neighbor->keys[i] = neighbor->keys[i + 1];
+                neighbor->heads[i] = neighbor->heads[i + 1];
                 neighbor->children_array[i] = neighbor->children_array[i + 1];
             }
             neighbor->children_array[i] = neighbor->children_array[i + 1];
         } else {
             for (i = 0; i < neighbor->num_keys - 1; i++) {
                 neighbor->keys[i] = neighbor->keys[i + 1];
+                neighbor->heads[i] = neighbor->heads[i + 1];
                 neighbor->values_array[i] = neighbor->values_array[i + 1];
+                neighbor->fingerprints[i] = neighbor->fingerprints[i + 1];
             }
         }
     }
@@ -280,10 +1133,9 @@ persistent_ptr<PmseTreeNode> PmseTree::redistributeNodes(
 
     n->num_keys++;
     neighbor->num_keys--;
-
-    if (_cursor.node == neighbor) {
-        _cursor.node = n;
-        _cursor.index = 0;
+    if (n->is_leaf) {
+        resetLeafSlots(n);
+        resetLeafSlots(neighbor);
     }
 
     return root;
@@ -295,14 +1147,13 @@ persistent_ptr<PmseTreeNode> PmseTree::redistributeNodes(
  * can accept the additional entries
  * without exceeding the maximum.
  */
-persistent_ptr<PmseTreeNode> PmseTree::coalesceNodes(
-                pool_base pop, persistent_ptr<PmseTreeNode> root,
-                persistent_ptr<PmseTreeNode> n,
-                persistent_ptr<PmseTreeNode> neighbor, int64_t neighbor_index,
-                BSONObj_PM k_prime) {
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::coalesceNodes(
+                NodePtr root, NodePtr n, NodePtr neighbor, int64_t neighbor_index,
+                PmseKey k_prime) {
     uint64_t i, j, neighbor_insertion_index, n_end;
-    persistent_ptr<PmseTreeNode> tmp;
-    BSONObj k_prime_temp;
+    NodePtr tmp;
+    std::string k_prime_temp;
 
     /* Swap neighbor with node if node is on the
      * extreme left and neighbor is to its right.
@@ -331,21 +1182,15 @@ persistent_ptr<PmseTreeNode> PmseTree::coalesceNodes(
 
         /* Append k_prime.
          */
-        BSONObj_PM bsonPM;
-        persistent_ptr<char> obj;
-
-        obj = pmemobj_tx_alloc(k_prime.getBSON().objsize(), 1);
-        memcpy((void*) obj.get(), k_prime.getBSON().objdata(),
-                        k_prime.getBSON().objsize());
-
-        bsonPM.data = obj;
-        neighbor->keys[neighbor_insertion_index].data = bsonPM.data;
+        neighbor->keys[neighbor_insertion_index].assign(k_prime.key(), StringData());
+        neighbor->heads[neighbor_insertion_index] = pmseKeyHead(k_prime.key());
         neighbor->num_keys++;
 
         n_end = n->num_keys;
 
         for (i = neighbor_insertion_index + 1, j = 0; j < n_end; i++, j++) {
             neighbor->keys[i] = n->keys[j];
+            neighbor->heads[i] = n->heads[j];
             neighbor->children_array[i] = n->children_array[j];
             neighbor->num_keys++;
             n->num_keys--;
@@ -374,38 +1219,45 @@ persistent_ptr<PmseTreeNode> PmseTree::coalesceNodes(
 
     else {
 
+        /* Slots can be moved as they are if both leaves have same prefix */
+        bool samePrefix = n->prefixSize == neighbor->prefixSize
+                        && (n->prefixSize == 0
+                            || n->prefix.key() == neighbor->prefix.key());
         for (i = neighbor_insertion_index, j = 0; j < n->num_keys; i++, j++) {
-            neighbor->keys[i] = n->keys[j];
+            if (samePrefix) {
+                neighbor->keys[i] = n->keys[j];
+                neighbor->heads[i] = n->heads[j];
+            } else {
+                std::string key = leafKeyString(n, j);
+                fitLeafPrefix(neighbor, key);
+                setLeafKey(neighbor, i, key, leafTypeBits(n, j));
+                n->keys[j].retire(_tree->_limbo);
+            }
             neighbor->values_array[i] = n->values_array[j];
+            neighbor->fingerprints[i] = n->fingerprints[j];
             neighbor->num_keys++;
         }
+        if (n->prefixSize > 0)
+            n->prefix.retire(_tree->_limbo);
+        resetLeafSlots(neighbor);
         if (n->next) {
             n->next->previous = neighbor;
+        } else {
+            setLast(neighbor);
         }
         neighbor->next = n->next;
     }
 
-    k_prime_temp = k_prime.getBSON();
+    k_prime_temp = k_prime.key().toString();
     for (i = 0; i < n->parent->num_keys; i++) {
-        int cmp = k_prime_temp.woCompare(n->parent->keys[i].getBSON(),
-                        _ordering, false);
-        if (cmp == 0) {
+        if (StringData(k_prime_temp) == n->parent->keys[i].key()) {
             break;
         }
     }
 
-    if (_cursor.node == n) {
-        _cursor.node = neighbor;
-        _cursor.index = 0;
-    }
+    root = deleteEntry(n->parent, i);
 
-    root = deleteEntry(pop, k_prime_temp, n->parent, i);
-
-    delete_persistent<BSONObj_PM[TREE_ORDER]>(n->keys);
-    if (n->is_leaf) {
-        delete_persistent<RecordId[TREE_ORDER]>(n->values_array);
-    }
-    delete_persistent<PmseTreeNode>(n);
+    _tree->_limbo.retire(n.raw());
 
     return root;
 }
@@ -418,7 +1270,8 @@ persistent_ptr<PmseTreeNode> PmseTree::coalesceNodes(
  * is the leftmost child), returns -1 to signify
  * this special case.
  */
-int64_t PmseTree::getNeighborIndex(persistent_ptr<PmseTreeNode> node) {
+template <uint64_t ORDER>
+int64_t PmseTreeImpl<ORDER>::getNeighborIndex(NodePtr node) {
 
     uint64_t i;
 
@@ -439,10 +1292,10 @@ int64_t PmseTree::getNeighborIndex(persistent_ptr<PmseTreeNode> node) {
 
 }
 
-persistent_ptr<PmseTreeNode> PmseTree::adjustRoot(
-                persistent_ptr<PmseTreeNode> root) {
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::adjustRoot(NodePtr root) {
 
-    persistent_ptr<PmseTreeNode> new_root;
+    NodePtr new_root;
 
     /* Case: nonempty root.
      * Key and pointer have already been deleted,
@@ -467,30 +1320,32 @@ persistent_ptr<PmseTreeNode> PmseTree::adjustRoot(
 
     else {
         new_root = nullptr;
+        _tree->first = nullptr;
+        _tree->last = nullptr;
+        retireLeafKeys(root);
     }
 
-    delete_persistent<BSONObj_PM[TREE_ORDER]>(root->keys);
-    delete_persistent<RecordId[TREE_ORDER]>(root->values_array);
-
-    delete_persistent<PmseTreeNode>(root);
+    _tree->_limbo.retire(root.raw());
     return new_root;
 
 }
 
-persistent_ptr<PmseTreeNode> PmseTree::removeEntryFromNode(
-                BSONObj& key, persistent_ptr<PmseTreeNode> node,
-                uint64_t index) {
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::removeEntryFromNode(NodePtr node, uint64_t index) {
     uint64_t i, num_pointers;
+    if (node->is_leaf && _unsorted) {
+        removeSlot(node, index);
+        return node;
+    }
     // Remove the key and shift other keys accordingly.
     i = index;
 
-    BSONObj_PM bsonPM;
-    bsonPM = (node->keys[i]);
-    pmemobj_tx_free(bsonPM.data.raw());
+    node->keys[i].retire(_tree->_limbo);
 
     i = index;
     for (++i; i < node->num_keys; i++) {
         node->keys[i - 1] = node->keys[i];
+        node->heads[i - 1] = node->heads[i];
 
     }
     // Remove the pointer and shift other pointers accordingly.
@@ -499,6 +1354,7 @@ persistent_ptr<PmseTreeNode> PmseTree::removeEntryFromNode(
         num_pointers = node->num_keys;
         for (++i; i < num_pointers; i++) {
             node->values_array[i - 1] = node->values_array[i];
+            node->fingerprints[i - 1] = node->fingerprints[i];
         }
     } else {
         num_pointers = node->num_keys + 1;
@@ -510,7 +1366,7 @@ persistent_ptr<PmseTreeNode> PmseTree::removeEntryFromNode(
 
     // Set the other pointers to NULL for tidiness.
     if (!node->is_leaf)
-        for (i = node->num_keys + 1; i < TREE_ORDER; i++)
+        for (i = node->num_keys + 1; i < ORDER; i++)
             node->children_array[i] = nullptr;
 
     node->num_keys--;
@@ -518,117 +1374,67 @@ persistent_ptr<PmseTreeNode> PmseTree::removeEntryFromNode(
     return node;
 }
 
-persistent_ptr<PmseTreeNode> PmseTree::locateLeafWithKey(
-                persistent_ptr<PmseTreeNode> node, BSONObj& key,
-                const BSONObj& _ordering) {
-    uint64_t i;
-    int64_t cmp;
-    bool wasEqual = false;
-    persistent_ptr<PmseTreeNode> current = node;
-
-    if (current == nullptr)
-        return current;
-    while (!current->is_leaf) {
-        i = 0;
-        while (i < current->num_keys) {
-
-            cmp = key.woCompare(current->keys[i].getBSON(), _ordering, false);
-            if (cmp > 0) {
-                i++;
-            } else {
-                if (cmp == 0) {
-                    if (wasEqual) {
-                        break;
-                    } else {
-                        wasEqual = true;
-                        i++;
-                    }
-
-                } else {
-                    break;
-                }
-            }
-        }
-        current = current->children_array[i];
+/*
+ * Child of inner node key belongs to. First separator equal to key on
+ * the way down is passed to its right.
+ */
+template <uint64_t ORDER>
+uint64_t PmseTreeImpl<ORDER>::childIndex(NodePtr node, StringData key, uint64_t head,
+                                         bool& wasEqual) {
+    int cmp;
+    uint64_t i = pmseLowerBound(reinterpret_cast<const uint64_t*>(node->heads),
+                                std::min<uint64_t>(node->num_keys, ORDER), key, head,
+                                [&](uint64_t index) { return node->keys[index].key(); }, cmp);
+    if (cmp == 0 && !wasEqual) {
+        wasEqual = true;
+        i++;
     }
-
-    return current;
+    return i;
 }
 
-persistent_ptr<PmseTreeNode> PmseTree::makeTreeRoot(BSONObj_PM& key,
-                                                    const RecordId& loc) {
-    auto n = make_persistent<PmseTreeNode>(true);
-    (n->keys[0]).data = key.data;
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::makeTreeRoot(StringData key, StringData typeBits,
+                                                     const RecordId& loc) {
+    auto n = make_persistent<PmseTreeNode<ORDER>>(true);
+    n->keys[0].assign(key, typeBits);
+    n->heads[0] = pmseKeyHead(key);
     n->values_array[0] = loc;
+    n->fingerprints[0] = pmseKeyFingerprint(key);
     n->num_keys = n->num_keys + 1;
+    resetLeafSlots(n);
     n->next = nullptr;
     n->previous = nullptr;
     n->parent = nullptr;
     return n;
 }
 
-persistent_ptr<PmseTreeNode> PmseTree::locateLeafWithKeyPM(
-                persistent_ptr<PmseTreeNode> node, BSONObj_PM& key,
-                const BSONObj& _ordering) {
-    uint64_t i;
-    int64_t cmp;
-    bool wasEqual = false;
-    persistent_ptr<PmseTreeNode> current = node;
-
-    if (current == nullptr)
-        return current;
-    while (!current->is_leaf) {
-        i = 0;
-        while (i < current->num_keys) {
-
-            cmp = key.getBSON().woCompare(current->keys[i].getBSON(), _ordering,
-                            false);
-            if (cmp > 0) {
-                i++;
-            } else {
-                if (cmp == 0) {
-                    if (wasEqual) {
-                        break;
-                    } else {
-                        wasEqual = true;
-                        i++;
-                    }
-
-                } else {
-                    break;
-                }
-            }
-        }
-        current = current->children_array[i];
-    }
-
-    return current;
-}
-
 /*
  * Insert leaf into correct place.
  */
-Status PmseTree::insertKeyIntoLeaf(persistent_ptr<PmseTreeNode> node,
-                                   BSONObj_PM& key, const RecordId& loc,
-                                   const BSONObj& _ordering) {
+template <uint64_t ORDER>
+Status PmseTreeImpl<ORDER>::insertKeyIntoLeaf(NodePtr node, StringData key,
+                                              StringData typeBits, const RecordId& loc) {
     uint64_t i, insertion_point;
-    insertion_point = 0;
+    int cmp;
 
-    while (insertion_point < node->num_keys
-                    && key.getBSON().woCompare(
-                                    node->keys[insertion_point].getBSON(),
-                                    _ordering, false) > 0) {
-        insertion_point++;
+    fitLeafPrefix(node, key);
+    insertion_point = leafLowerBound(node, key, cmp);
 
+    if (_unsorted) {
+        insertSlot(node, insertion_point, key, typeBits, loc);
+        return Status::OK();
     }
 
     for (i = node->num_keys; i > insertion_point; i--) {
         node->keys[i] = node->keys[i - 1];
+        node->heads[i] = node->heads[i - 1];
         node->values_array[i] = node->values_array[i - 1];
+        node->fingerprints[i] = node->fingerprints[i - 1];
     }
 
-    node->keys[insertion_point].data = key.data;
+    setLeafKey(node, insertion_point, key, typeBits);
     node->values_array[insertion_point] = loc;
+    node->fingerprints[insertion_point] = pmseKeyFingerprint(key);
     node->num_keys = node->num_keys + 1;
 
     return Status::OK();
@@ -637,7 +1443,8 @@ Status PmseTree::insertKeyIntoLeaf(persistent_ptr<PmseTreeNode> node,
 /* Finds the appropriate place to
  * split a node that is too big into two.
  */
-uint64_t PmseTree::cut(uint64_t length) {
+template <uint64_t ORDER>
+uint64_t PmseTreeImpl<ORDER>::cut(uint64_t length) {
     if (length % 2 == 0)
         return length / 2;
     else
@@ -647,27 +1454,25 @@ uint64_t PmseTree::cut(uint64_t length) {
 /*
  * Split node and insert value
  */
-persistent_ptr<PmseTreeNode> PmseTree::splitFullNodeAndInsert(
-                pool_base pop, persistent_ptr<PmseTreeNode> node,
-                BSONObj_PM& key, const RecordId& loc,
-                const BSONObj& _ordering) {
-    persistent_ptr<PmseTreeNode> new_leaf;
-    BSONObj_PM new_key;
-    uint64_t insertion_index = 0;
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::splitFullNodeAndInsert(NodePtr node, StringData key,
+                                                               StringData typeBits,
+                                                               const RecordId& loc,
+                                                               PmseLatchSet& latches) {
+    NodePtr new_leaf;
+    uint64_t insertion_index;
     uint64_t i, j, split;
-    persistent_ptr<PmseTreeNode> new_root;
-    new_leaf = make_persistent<PmseTreeNode>(true);
-    BSONObj_PM temp_keys_array[TREE_ORDER + 1];
-    RecordId temp_values_array[TREE_ORDER + 1];
-
-    while (insertion_index < (node->num_keys)
-                    && key.getBSON().woCompare(
-                                    node->keys[insertion_index].getBSON(),
-                                    _ordering, false) > 0) {
-        insertion_index++;
-
-    }
-    split = cut(TREE_ORDER);
+    int cmp;
+    NodePtr new_root;
+    new_leaf = make_persistent<PmseTreeNode<ORDER>>(true);
+    PmseKey temp_keys_array[ORDER + 1];
+    uint64_t temp_heads[ORDER + 1];
+    RecordId temp_values_array[ORDER + 1];
+    uint8_t temp_fingerprints[ORDER + 1];
+
+    fitLeafPrefix(node, key);
+    insertion_index = leafLowerBound(node, key, cmp);
+    split = cut(ORDER);
 
     /*
      * Copy from existing to temp, leaving space for inserted one
@@ -675,15 +1480,20 @@ persistent_ptr<PmseTreeNode> PmseTree::splitFullNodeAndInsert(
     for (i = 0, j = 0; i < node->num_keys; i++, j++) {
         if (j == insertion_index)
             j++;
-        temp_keys_array[j] = node->keys[i];
-        temp_values_array[j] = node->values_array[i];
+        uint64_t slot = slotOf(node, i);
+        temp_keys_array[j] = node->keys[slot];
+        temp_heads[j] = node->heads[slot];
+        temp_values_array[j] = node->values_array[slot];
+        temp_fingerprints[j] = node->fingerprints[slot];
     }
 
     /*
      * Fill free slot with inserted key
      */
-    temp_keys_array[insertion_index].data = key.data;
+    temp_keys_array[insertion_index].assign(key.substr(node->prefixSize), typeBits);
+    temp_heads[insertion_index] = pmseKeyHead(key.substr(node->prefixSize));
     temp_values_array[insertion_index] = loc;
+    temp_fingerprints[insertion_index] = pmseKeyFingerprint(key);
 
     /*
      * Now copy from temp array to new and to old
@@ -691,39 +1501,66 @@ persistent_ptr<PmseTreeNode> PmseTree::splitFullNodeAndInsert(
     node->num_keys = 0;
     for (i = 0; i < split; i++) {
         node->keys[i] = temp_keys_array[i];
+        node->heads[i] = temp_heads[i];
         node->values_array[i] = temp_values_array[i];
+        node->fingerprints[i] = temp_fingerprints[i];
         node->num_keys = node->num_keys + 1;
     }
     /*
      * Copy rest of keys to new node
      */
-    for (i = split, j = 0; i < (TREE_ORDER + 1); i++, j++) {
+    new_leaf->prefixSize = node->prefixSize;
+    if (node->prefixSize > 0)
+        new_leaf->prefix.assign(node->prefix.key(), StringData());
+    for (i = split, j = 0; i < (ORDER + 1); i++, j++) {
         new_leaf->keys[j] = temp_keys_array[i];
+        new_leaf->heads[j] = temp_heads[i];
         new_leaf->values_array[j] = temp_values_array[i];
+        new_leaf->fingerprints[j] = temp_fingerprints[i];
         new_leaf->num_keys = new_leaf->num_keys + 1;
     }
+    resetLeafSlots(node);
+    resetLeafSlots(new_leaf);
+    /*
+     * Halves may share longer prefix than whole node
+     */
+    rebuildLeafPrefix(node);
+    rebuildLeafPrefix(new_leaf);
     /*
      * Update pointers next, previous
      */
     new_leaf->next = node->next;
     if (node->next)
         node->next->previous = new_leaf;
+    else
+        setLast(new_leaf);
     node->next = new_leaf;
     new_leaf->previous = node;
 
+    if (_volatileInner) {
+        /* Applied once transaction commits, see unlinkLeaf() */
+        std::string separator = leafKeyString(new_leaf, 0);
+        PmseTreeNode<ORDER>* left = node.get();
+        PmseTreeNode<ORDER>* right = new_leaf.get();
+        latches.afterCommit([this, left, separator, right] {
+            _innerLatch.lock();
+            _inner.insertLeaf(left, separator, right);
+            _innerLatch.unlock();
+        });
+        return root();
+    }
+
     /*
      * Update parents
      */
     new_leaf->parent = node->parent;
-    new_key = new_leaf->keys[0];
-    new_root = insertIntoNodeParent(pop, root, node, new_key, new_leaf);
-    last = new_leaf;
+    new_root = insertIntoNodeParent(root(), node, leafKeyString(new_leaf, 0), new_leaf);
 
     return new_root;
 }
 
-uint64_t PmseTree::getLeftIndex(persistent_ptr<PmseTreeNode> parent,
-                                persistent_ptr<PmseTreeNode> left) {
+template <uint64_t ORDER>
+uint64_t PmseTreeImpl<ORDER>::getLeftIndex(NodePtr parent, NodePtr left) {
     uint64_t left_index = 0;
     while (left_index <= parent->num_keys
                     && parent->children_array[left_index] != left) {
@@ -736,36 +1573,41 @@ uint64_t PmseTree::getLeftIndex(persistent_ptr<PmseTreeNode> parent,
  * Insert key into internal node
  * Returns root.
  */
-persistent_ptr<PmseTreeNode> PmseTree::insertKeyIntoNode(
-                pool_base pop, persistent_ptr<PmseTreeNode> root,
-                persistent_ptr<PmseTreeNode> n, uint64_t left_index,
-                BSONObj_PM& new_key, persistent_ptr<PmseTreeNode> right) {
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::insertKeyIntoNode(NodePtr root, NodePtr n,
+                                                          uint64_t left_index,
+                                                          PmseKey& new_key,
+                                                          NodePtr right) {
     uint64_t i;
 
     for (i = n->num_keys; i > left_index; i--) {
         n->children_array[i + 1] = n->children_array[i];
         n->keys[i] = n->keys[i - 1];
+        n->heads[i] = n->heads[i - 1];
     }
     n->children_array[left_index + 1] = right;
     n->keys[left_index] = new_key;
+    n->heads[left_index] = pmseKeyHead(new_key.key());
     n->num_keys = n->num_keys + 1;
 
     return root;
 }
 
-persistent_ptr<PmseTreeNode> PmseTree::insertToNodeAfterSplit(
-                pool_base pop, persistent_ptr<PmseTreeNode> root,
-                persistent_ptr<PmseTreeNode> old_node, uint64_t left_index,
-                BSONObj_PM& new_key, persistent_ptr<PmseTreeNode> right) {
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::insertToNodeAfterSplit(NodePtr root, NodePtr old_node,
+                                                               uint64_t left_index,
+                                                               PmseKey& new_key,
+                                                               NodePtr right) {
 
     uint64_t i = 0, j, split;
-    BSONObj_PM k_prime;
-    persistent_ptr<PmseTreeNode> new_node;
-    persistent_ptr<PmseTreeNode> child;
-    persistent_ptr<PmseTreeNode> new_root;
-    new_node = make_persistent<PmseTreeNode>(false);
-    persistent_ptr<PmseTreeNode> temp_children_array[TREE_ORDER + 2];
-    BSONObj_PM temp_keys_array[TREE_ORDER + 1];
+    PmseKey k_prime;
+    NodePtr new_node;
+    NodePtr child;
+    NodePtr new_root;
+    new_node = make_persistent<PmseTreeNode<ORDER>>(false);
+    NodePtr temp_children_array[ORDER + 2];
+    PmseKey temp_keys_array[ORDER + 1];
+    uint64_t temp_heads[ORDER + 1];
 
     for (i = 0, j = 0; i < old_node->num_keys + 1; i++, j++) {
 
@@ -778,31 +1620,31 @@ persistent_ptr<PmseTreeNode> PmseTree::insertToNodeAfterSplit(
         if (j == left_index)
             j++;
         temp_keys_array[j] = old_node->keys[i];
+        temp_heads[j] = old_node->heads[i];
     }
 
     temp_children_array[left_index + 1] = right;
     temp_keys_array[left_index] = new_key;
+    temp_heads[left_index] = pmseKeyHead(new_key.key());
 
-    split = cut(TREE_ORDER + 1);
+    split = cut(ORDER + 1);
     old_node->num_keys = 0;
     for (i = 0; i < split - 1; i++) {
         old_node->children_array[i] = temp_children_array[i];
         old_node->keys[i] = temp_keys_array[i];
+        old_node->heads[i] = temp_heads[i];
         old_node->num_keys = old_node->num_keys + 1;
     }
 
-    BSONObj_PM bsonPM;
-
-    bsonPM = old_node->keys[split - 1];
-    if (bsonPM.data.raw().off != 0)
-        pmemobj_tx_free(bsonPM.data.raw());
-
     old_node->children_array[i] = temp_children_array[i];
     k_prime = temp_keys_array[split - 1];
+    /* Parent gets its own copy of k_prime */
+    k_prime.retire(_tree->_limbo);
 
-    for (++i, j = 0; i < (TREE_ORDER + 1); i++, j++) {
+    for (++i, j = 0; i < (ORDER + 1); i++, j++) {
         new_node->children_array[j] = temp_children_array[i];
         new_node->keys[j] = temp_keys_array[i];
+        new_node->heads[j] = temp_heads[i];
         new_node->num_keys = new_node->num_keys + 1;
     }
     new_node->children_array[j] = temp_children_array[i];
@@ -811,7 +1653,7 @@ persistent_ptr<PmseTreeNode> PmseTree::insertToNodeAfterSplit(
         child = new_node->children_array[i];
         child->parent = new_node;
     }
-    new_root = insertIntoNodeParent(pop, root, old_node, k_prime, new_node);
+    new_root = insertIntoNodeParent(root, old_node, k_prime.key(), new_node);
 
     return new_root;
 }
@@ -820,32 +1662,26 @@ persistent_ptr<PmseTreeNode> PmseTree::insertToNodeAfterSplit(
  * Inserts a new node into tree structure.
  * Returns root after tree modification.
  */
-persistent_ptr<PmseTreeNode> PmseTree::insertIntoNodeParent(
-                pool_base pop, persistent_ptr<PmseTreeNode> root,
-                persistent_ptr<PmseTreeNode> left, BSONObj_PM& key,
-                persistent_ptr<PmseTreeNode> right) {
-    persistent_ptr<PmseTreeNode> parent;
-    BSONObj_PM newKey;
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::insertIntoNodeParent(NodePtr root, NodePtr left,
+                                                             StringData key,
+                                                             NodePtr right) {
+    NodePtr parent;
+    PmseKey newKey;
 
     uint64_t left_index;
     parent = left->parent;
 
-    persistent_ptr<char> obj;
-
-    transaction::exec_tx(pop,
+    transaction::exec_tx(_pop,
                     [&] {
-                        obj = pmemobj_tx_alloc(key.getBSON().objsize(), 1);
-                        memcpy( (void*)obj.get(), key.getBSON().objdata(), key.getBSON().objsize());
-
+                        newKey.assign(key, StringData());
                     });
 
-    newKey.data = obj;
-
     /*
      * Check if parent exist. If not, create new one.
      */
     if (parent == nullptr)
-        return allocateNewRoot(pop, left, newKey, right);
+        return allocateNewRoot(left, newKey, right);
 
     /*
      * There is parent, insert key into it.
@@ -857,24 +1693,26 @@ persistent_ptr<PmseTreeNode> PmseTree::insertIntoNodeParent(
     /*
      * If there is slot for new key - just insert
      */
-    if (parent->num_keys < TREE_ORDER) {
-        return insertKeyIntoNode(pop, root, parent, left_index, newKey, right);
+    if (parent->num_keys < ORDER) {
+        return insertKeyIntoNode(root, parent, left_index, newKey, right);
     }
     /*
      * There is no slot for new key - we need to split
      */
-    return insertToNodeAfterSplit(pop, root, parent, left_index, newKey, right);
+    return insertToNodeAfterSplit(root, parent, left_index, newKey, right);
 }
+
 /*
  * Allocate node for new root and fill it with key.
  */
-persistent_ptr<PmseTreeNode> PmseTree::allocateNewRoot(
-                pool_base pop, persistent_ptr<PmseTreeNode> left,
-                BSONObj_PM& new_key, persistent_ptr<PmseTreeNode> right) {
-    persistent_ptr<PmseTreeNode> new_root;
-    new_root = make_persistent<PmseTreeNode>(false);
-
-    new_root->keys[0].data = new_key.data;
+template <uint64_t ORDER>
+PmseNodePtr<ORDER> PmseTreeImpl<ORDER>::allocateNewRoot(NodePtr left, PmseKey& new_key,
+                                                        NodePtr right) {
+    NodePtr new_root;
+    new_root = make_persistent<PmseTreeNode<ORDER>>(false);
+
+    new_root->keys[0] = new_key;
+    new_root->heads[0] = pmseKeyHead(new_key.key());
     new_root->children_array[0] = left;
     new_root->children_array[1] = right;
     new_root->num_keys = new_root->num_keys + 1;
@@ -885,51 +1723,104 @@ persistent_ptr<PmseTreeNode> PmseTree::allocateNewRoot(
     return new_root;
 }
 
-Status PmseTree::insert(pool_base pop, BSONObj_PM& key, const RecordId& loc,
-                        const BSONObj& _ordering, bool dupsAllowed) {
+/*
+ * Key fitting into its leaf is inserted with only that leaf latched, it
+ * must still have version seen on the way down. Empty tree or full leaf
+ * is changed under structure mutex, see latchSplit().
+ */
+template <uint64_t ORDER>
+Status PmseTreeImpl<ORDER>::insert(const BSONObj& bsonKey, const RecordId& loc,
+                                   bool dupsAllowed, PmseLatchSet& latches) {
 
-    persistent_ptr<PmseTreeNode> node;
+    NodePtr node;
+    uint64_t version;
     Status status = Status::OK();
+    KeyString ks(TREE_KEY_VERSION, bsonKey, _keyOrdering);
+    StringData key(ks.getBuffer(), ks.getSize());
+    StringData typeBits = typeBitsOf(ks);
+
+    while (true) {
+        node = findLeaf(key, version);
+        if (node == nullptr || node->num_keys >= ORDER) {
+            latches.lockStructure(_structureMutex);
+            node = findLeaf(key, version);
+            if (node != nullptr)
+                latches.lock(node.get());
+            break;
+        }
+        if (latches.tryUpgrade(node.get(), version))
+            break;
+    }
 
-    if (!root)   //root not allocated yet
+    if (node == nullptr)   //root not allocated yet
     {
-        try {
-            transaction::exec_tx(pop, [&] {
-                root = makeTreeRoot(key,loc);
-                first = root;
-                last = root;
-            });
-        } catch (std::exception &e) {
-            std::cout << e.what() << std::endl;
-        }
+        latches.lock(anchor());
+        transaction::exec_tx(_pop, [&] {
+            NodePtr root = makeTreeRoot(key, typeBits, loc);
+            _tree->first = root.raw();
+            setLast(root);
+            if (_volatileInner) {
+                PmseTreeNode<ORDER>* leaf = root.get();
+                latches.afterCommit([this, leaf] {
+                    std::vector<std::string> separators;
+                    _innerLatch.lock();
+                    _inner.build({leaf}, separators);
+                    _innerLatch.unlock();
+                });
+            } else {
+                setRoot(root);
+            }
+        });
         return Status::OK();
     }
-    node = locateLeafWithKeyPM(root, key, _ordering);
+
+    if (!dupsAllowed && duplicateIn(node, key, loc))
+        return Status(ErrorCodes::DuplicateKey, "duplicate key");
     /*
      * There is place for new value
      */
-    if (node->num_keys < (TREE_ORDER)) {
-        try {
-            transaction::exec_tx(pop, [&] {
-                status = insertKeyIntoLeaf(node,key,loc,_ordering);
-            });
-        } catch (std::exception &e) {
-            std::cout << e.what() << std::endl;
-        }
+    if (node->num_keys < ORDER) {
+        if (_unsorted && publishSlot(node, key, typeBits, loc))
+            return Status::OK();
+        transaction::exec_tx(_pop, [&] {
+            status = insertKeyIntoLeaf(node, key, typeBits, loc);
+        });
         return status;
     }
 
     /*
      * splitting
      */
-    try {
-        transaction::exec_tx(pop, [&] {
-            root = splitFullNodeAndInsert(pop,node,key,loc,_ordering);
-        });
-    } catch (std::exception &e) {
-        std::cout << e.what() << std::endl;
-    }
+    latchSplit(node, latches);
+    transaction::exec_tx(_pop, [&] {
+        setRoot(splitFullNodeAndInsert(node, key, typeBits, loc, latches));
+    });
     return Status::OK();
 }
 
+/*
+ * Latches nodes split of full leaf changes, before anything is changed:
+ * leaf, leaf after it, full ancestors and first one with free slot,
+ * anchor if last leaf or root changes. New nodes aren't latched, they
+ * are reached only through latched ones.
+ */
+template <uint64_t ORDER>
+void PmseTreeImpl<ORDER>::latchSplit(NodePtr leaf, PmseLatchSet& latches) {
+    latches.lock(leaf.get());
+    latchOrAnchor(leaf->next, latches);
+    if (_volatileInner)
+        return;
+    NodePtr node = leaf->parent;
+    while (node != nullptr && node->num_keys >= ORDER) {
+        latches.lock(node.get());
+        node = node->parent;
+    }
+    latchOrAnchor(node, latches);
+}
+
+template class PmseTreeImpl<16>;
+template class PmseTreeImpl<32>;
+template class PmseTreeImpl<64>;
+template class PmseTreeImpl<128>;
+
 }
@@ -33,8 +33,18 @@
 #ifndef SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_TREE_H_
 #define SRC_MONGO_DB_MODULES_PMSTORE_SRC_PMSE_TREE_H_
 
+#include "mongo/bson/ordering.h"
+#include "mongo/db/storage/key_string.h"
 #include "mongo/db/storage/sorted_data_interface.h"
 #include "mongo/db/index/index_descriptor.h"
+#include "mongo/platform/endian.h"
+#include "mongo/stdx/mutex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
 
 #include <libpmemobj.h>
 #include <libpmemobj++/make_persistent.hpp>
@@ -45,148 +55,487 @@
 #include <libpmemobj++/pool.hpp>
 #include "libpmemobj++/transaction.hpp"
 
+#include "pmse_epoch.h"
+#include "pmse_inner_index.h"
+#include "pmse_latch.h"
+
 using namespace nvml::obj;
 
 namespace mongo {
 
-const uint64_t TREE_ORDER = 3;     //number of elements in internal node
 const int64_t BSON_MIN_SIZE = 5;
 
-const uint64_t MAX_END = 2;
-const uint64_t MIN_END = 1;
+/* Node fanouts trees can be created with */
+const uint64_t TREE_FANOUT_MIN = 16;
+const uint64_t TREE_FANOUT_MAX = 128;
+/* Slots of one node and keys they point to should fit in about this size */
+const uint64_t TREE_NODE_BYTES = 4096;
+
+/*
+ * Keys up to this size are stored in node slot, longer ones out of line.
+ * Changes layout of index pools.
+ */
+#ifndef PMSE_INLINE_KEY_SIZE
+#define PMSE_INLINE_KEY_SIZE 32
+#endif
+const int64_t TREE_INLINE_KEY_SIZE = PMSE_INLINE_KEY_SIZE;
+
+/* Encoding of keys stored in tree */
+const KeyString::Version TREE_KEY_VERSION = KeyString::Version::V1;
+
+/*
+ * First 8 bytes of encoded key as big-endian integer, zero padded. Type
+ * byte and leading value bytes of date, ObjectId or integer key fit in it,
+ * so most comparisons of such keys are decided by heads alone.
+ */
+inline uint64_t pmseKeyHead(StringData key) {
+    uint64_t head = 0;
+    memcpy(&head, key.rawData(), std::min(key.size(), sizeof(head)));
+    return endian::bigToNative(head);
+}
+
+/* Same result as key.compare(other), keys with different heads aren't read */
+inline int pmseCompareKeys(StringData key, uint64_t keyHead,
+                           StringData other, uint64_t otherHead) {
+    if (keyHead != otherHead)
+        return keyHead < otherHead ? -1 : 1;
+    return key.compare(other);
+}
+
+/* Number of leading heads less than head, heads must be sorted */
+uint64_t pmseCountHeadsLess(const uint64_t* heads, uint64_t count, uint64_t head);
+
+/*
+ * Index of first of count sorted keys not less than key, so first of run
+ * of keys equal to it. Heads narrow the range, keys with head equal to
+ * key's are binary searched with keyAt(index). cmp is result of comparing
+ * key with found one, 1 if all keys are less.
+ */
+template <typename KeyAt>
+uint64_t pmseLowerBound(const uint64_t* heads, uint64_t count, StringData key,
+                        uint64_t head, KeyAt keyAt, int& cmp) {
+    uint64_t lo = pmseCountHeadsLess(heads, count, head);
+    uint64_t hi = lo;
+    if (head == std::numeric_limits<uint64_t>::max())
+        hi = count;
+    else
+        hi += pmseCountHeadsLess(heads + lo, count - lo, head + 1);
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (key.compare(keyAt(mid)) > 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    cmp = lo < count ? pmseCompareKeys(key, head, keyAt(lo), heads[lo]) : 1;
+    return lo;
+}
 
-class BSONObj_PM {
+/*
+ * Key in node slot, KeyString encoded for index ordering so keys are
+ * compared with memcmp. Type bits needed to decode key follow it.
+ */
+class PmseKey {
 public:
-    BSONObj_PM() = default;
+    PmseKey() = default;
+    PmseKey(const PmseKey& other) = default;
 
-    BSONObj_PM(persistent_ptr<char> inputData) {
-        data = inputData;
+    /* Slot in pool is snapshotted, so keys can be moved in transaction */
+    PmseKey& operator=(const PmseKey& other) {
+        if (this == &other)
+            return *this;
+        _snapshot();
+        data = other.data;
+        memcpy(inlineData, other.inlineData, sizeof(inlineData));
+        _keySize = other._keySize;
+        _size = other._size;
+        return *this;
     }
 
-    BSONObj getBSON() {
-        char* data_ptr = data.get();
-        return BSONObj(data_ptr);
+    StringData key() const {
+        return StringData(_bytes(), _keySize);
     }
-    persistent_ptr<char> data;
-    uint64_t minMax = 0;
-};
 
-struct PmseTreeNode {
-    PmseTreeNode() :
-                    num_keys(0) {
+    /* Sizes read without latch by reader can belong to different keys */
+    StringData typeBits() const {
+        return StringData(_bytes() + _keySize, _size > _keySize ? _size - _keySize : 0);
     }
 
-    PmseTreeNode(bool node_leaf) :
-                    num_keys(0) {
-        uint64_t i;
-        keys = make_persistent<BSONObj_PM[TREE_ORDER]>();
+    /* Copies key into slot, must be called inside transaction */
+    void assign(StringData key, StringData typeBits) {
+        _snapshot();
+        assignUnlogged(key, typeBits);
+    }
 
-        if (node_leaf) {
-            values_array = make_persistent<RecordId[TREE_ORDER]>();
-            is_leaf = true;
+    /* Same as assign(), for free slot whose old content needn't be restored */
+    void assignUnlogged(StringData key, StringData typeBits) {
+        uint32_t size = key.size() + typeBits.size();
+        char* dest = inlineData;
+        if (size <= TREE_INLINE_KEY_SIZE) {
+            data = nullptr;
         } else {
-            for (i = 0; i < TREE_ORDER; i++) {
-                children_array[i] = nullptr;
-            }
+            data = pmemobj_tx_alloc(size, 1);
+            dest = data.get();
         }
-        next = nullptr;
-        previous = nullptr;
+        memcpy(dest, key.rawData(), key.size());
+        memcpy(dest + key.size(), typeBits.rawData(), typeBits.size());
+        _keySize = key.size();
+        _size = size;
     }
 
-    p<uint64_t> num_keys = 0;
-    persistent_ptr<BSONObj_PM[TREE_ORDER]> keys;
-    persistent_ptr<PmseTreeNode> children_array[TREE_ORDER + 1]; /* Exist only for internal nodes */
+    /* Out of line copy is freed when no cursor can see it */
+    void retire(PmseLimbo& limbo) {
+        if (data)
+            limbo.retire(data.raw());
+    }
 
-    persistent_ptr<RecordId[TREE_ORDER]> values_array; /* Exist only for leaf nodes */
+    persistent_ptr<char> data;
+    char inlineData[TREE_INLINE_KEY_SIZE];
 
-    persistent_ptr<PmseTreeNode> next = nullptr;
-    persistent_ptr<PmseTreeNode> previous = nullptr;
-    persistent_ptr<PmseTreeNode> parent = nullptr;
+private:
+    const char* _bytes() const {
+        return data ? data.get() : inlineData;
+    }
+
+    void _snapshot() {
+        if (pmemobj_tx_stage() == TX_STAGE_WORK && pmemobj_pool_by_ptr(this))
+            pmemobj_tx_add_range_direct(this, sizeof(*this));
+    }
+
+    uint32_t _keySize = 0;
+    uint32_t _size = 0;
+};
+
+/*
+ * Header common for nodes of all fanouts.
+ */
+struct PmseTreeNodeBase {
+    p<uint64_t> num_keys = 0;
     p<bool> is_leaf = false;
 };
 
+/*
+ * Node with ORDER slots. Slots are part of the node, so search of one
+ * node reads one contiguous object.
+ */
+template <uint64_t ORDER>
+struct PmseTreeNode : public PmseTreeNodeBase {
+    static_assert(ORDER <= 256, "slot order entries are one byte");
+
+    PmseTreeNode() : PmseTreeNode(false) {}
+
+    explicit PmseTreeNode(bool node_leaf) {
+        is_leaf = node_leaf;
+        for (uint64_t i = 0; i < ORDER; i++)
+            slotOrder[i] = i;
+    }
+
+    /* In leaves slots hold keys without bytes shared by whole leaf */
+    PmseKey keys[ORDER];
+    /* pmseKeyHead() of each slot key, searched before keys are read */
+    p<uint64_t> heads[ORDER];
+    p<RecordId> values_array[ORDER];    /* Used only by leaf nodes */
+    /* Leaf only: one byte hash of each key, checked before key is compared */
+    p<uint8_t> fingerprints[ORDER];
+    persistent_ptr<PmseTreeNode> children_array[ORDER + 1]; /* Used only by internal nodes */
+
+    persistent_ptr<PmseTreeNode> next;
+    persistent_ptr<PmseTreeNode> previous;
+    persistent_ptr<PmseTreeNode> parent;
+
+    /* Leading bytes equal in all keys of leaf, stored once */
+    PmseKey prefix;
+    p<uint64_t> prefixSize = 0;
+
+    /*
+     * Unsorted leaves only: slots in key order, first num_keys are used,
+     * rest are free. Bit of slot is set while slot holds a key.
+     */
+    uint8_t slotOrder[ORDER];
+    p<uint64_t> slotBitmap[(ORDER + 63) / 64] = {};
+};
+
+template <uint64_t ORDER>
+using PmseNodePtr = persistent_ptr<PmseTreeNode<ORDER>>;
+
+template <uint64_t ORDER>
 struct CursorObject {
-    persistent_ptr<PmseTreeNode> node;
+    PmseNodePtr<ORDER> node;
     uint64_t index;
 };
 
+/*
+ * Compares encoded key with keys of one leaf. Prefix shared by the leaf
+ * is compared once, then only suffixes stored in slots.
+ */
+class PmseLeafComparator {
+public:
+    PmseLeafComparator(StringData key, StringData prefix);
+
+    /* Same result as key.compare(prefix + suffix) */
+    int compare(StringData suffix) const {
+        return _prefixResult != 0 ? _prefixResult : _rest.compare(suffix);
+    }
+
+    /* Same as compare(suffix), head is pmseKeyHead(suffix) */
+    int compare(uint64_t head, StringData suffix) const {
+        if (_prefixResult != 0)
+            return _prefixResult;
+        return pmseCompareKeys(_rest, _restHead, suffix, head);
+    }
+
+    /* Key bytes following prefix and their head */
+    StringData rest() const {
+        return _rest;
+    }
+    uint64_t head() const {
+        return _restHead;
+    }
+
+    /* False if no key of leaf can be equal to key */
+    bool prefixMatches() const {
+        return _prefixResult == 0;
+    }
+
+private:
+    int _prefixResult = 0;
+    StringData _rest;
+    uint64_t _restHead = 0;
+};
+
+/*
+ * Root object of index pool. Fanout is chosen when index is created,
+ * nodes are accessed through PmseTreeImpl of that fanout.
+ */
 class PmseTree {
-    friend class PmseCursor;
+    template <uint64_t ORDER> friend class PmseTreeImpl;
+
+public:
+    uint64_t fanout() const {
+        return _fanout;
+    }
+
+    /* Must be called inside transaction, before first insert */
+    void setFanout(uint64_t fanout) {
+        _fanout = fanout;
+    }
+
+    bool unsortedLeaves() const {
+        return _unsortedLeaves;
+    }
+
+    /* Must be called inside transaction, before first insert */
+    void setUnsortedLeaves(bool unsorted) {
+        _unsortedLeaves = unsorted;
+    }
+
+    bool volatileInnerNodes() const {
+        return _volatileInnerNodes;
+    }
+
+    /* Must be called inside transaction, before first insert */
+    void setVolatileInnerNodes(bool inDram) {
+        _volatileInnerNodes = inDram;
+    }
+
+    /* Frees nodes and keys no cursor can reference */
+    uint64_t releaseRetired(pool_base pop, uint64_t epoch, uint64_t maxObjects) {
+        return _limbo.release(pop, epoch, maxObjects);
+    }
+
+private:
+    p<uint64_t> _fanout = 0;
+    persistent_ptr<PmseTreeNodeBase> root;
+    persistent_ptr<PmseTreeNodeBase> first;
+    persistent_ptr<PmseTreeNodeBase> last;
+    /* Removed nodes and keys wait here for cursors to leave them */
+    PmseLimbo _limbo;
+    p<bool> _unsortedLeaves = false;
+    /* Only leaves are persistent, root is unused */
+    p<bool> _volatileInnerNodes = false;
+};
+
+/*
+ * Operations on tree, independent of its fanout.
+ */
+class PmseTreeBase {
+public:
+    virtual ~PmseTreeBase() = default;
+
+    /*
+     * Must be called inside transaction, key is copied into tree. Nodes
+     * are latched in latches, which must be released after transaction
+     * ends. Key stored for other record fails with DuplicateKey unless
+     * dupsAllowed. Errors of pool transactions are thrown to caller.
+     */
+    virtual Status insert(const BSONObj& key, const RecordId& loc, bool dupsAllowed,
+                          PmseLatchSet& latches) = 0;
+    /* Same as insert(), false if no entry was removed */
+    virtual bool remove(const BSONObj& key, const RecordId& loc, bool dupsAllowed,
+                        PmseLatchSet& latches) = 0;
+    /* True if key is stored for other record than loc */
+    virtual bool hasDuplicate(const BSONObj& key, const RecordId& loc) = 0;
+    virtual uint64_t prefaultInnerNodes() = 0;
+    virtual std::unique_ptr<SortedDataInterface::Cursor> newCursor(
+                    OperationContext* txn, bool isForward) = 0;
+    /* Version words of tree nodes, latch sets of writes use them */
+    virtual PmseLatchTable& latchTable() = 0;
+};
+
+/* Hash of encoded key for leaf fingerprints */
+uint8_t pmseKeyFingerprint(StringData key);
+
+/* Picks fanout for new index, wider keys get smaller nodes */
+uint64_t pmseTreeFanout(const BSONObj& keyPattern);
+
+/* Keys are encoded for ordering of keyPattern */
+std::unique_ptr<PmseTreeBase> pmseOpenTree(pool_base pop, persistent_ptr<PmseTree> tree,
+                                           const BSONObj& keyPattern);
+
+template <uint64_t ORDER> class PmseCursor;
+
+template <uint64_t ORDER>
+class PmseTreeImpl : public PmseTreeBase {
+    friend class PmseCursor<ORDER>;
 
 public:
-    Status insert(pool_base pop, BSONObj_PM& key, const RecordId& loc,
-                  const BSONObj& _ordering, bool dupsAllowed);
-    void remove(pool_base pop, BSONObj& key, const RecordId& loc,
-                bool dupsAllowed, const BSONObj& _ordering);
+    PmseTreeImpl(pool_base pop, persistent_ptr<PmseTree> tree, const BSONObj& keyPattern);
+
+    Status insert(const BSONObj& key, const RecordId& loc, bool dupsAllowed,
+                  PmseLatchSet& latches) override;
+    bool remove(const BSONObj& key, const RecordId& loc, bool dupsAllowed,
+                PmseLatchSet& latches) override;
+    bool hasDuplicate(const BSONObj& key, const RecordId& loc) override;
+    uint64_t prefaultInnerNodes() override;
+    std::unique_ptr<SortedDataInterface::Cursor> newCursor(
+                    OperationContext* txn, bool isForward) override;
+    PmseLatchTable& latchTable() override {
+        return _latches;
+    }
 
 private:
+    typedef PmseNodePtr<ORDER> NodePtr;
+
+    NodePtr root() const {
+        return _tree->root.raw();
+    }
+    NodePtr first() const {
+        return _tree->first.raw();
+    }
+    NodePtr last() const {
+        return _tree->last.raw();
+    }
+    void setRoot(NodePtr node) {
+        if (root() != node)
+            _tree->root = node.raw();
+    }
+    void setLast(NodePtr node) {
+        _tree->last = node.raw();
+    }
+
+    /* Anchor of root, first and last node, latched when they change */
+    const void* anchor() const {
+        return _tree.get();
+    }
+
+    std::string encodeKey(const BSONObj& key,
+                          KeyString::Discriminator discriminator = KeyString::kInclusive) const {
+        KeyString ks(TREE_KEY_VERSION, key, _keyOrdering, discriminator);
+        return std::string(ks.getBuffer(), ks.getSize());
+    }
+    BSONObj decodeKey(StringData key, StringData typeBits) const;
+
+    /*
+     * Leaf key belongs to, found through inner nodes in DRAM or pool
+     * without latches. version is version of leaf when it was reached.
+     */
+    NodePtr findLeaf(StringData key, uint64_t& version);
+    uint64_t childIndex(NodePtr node, StringData key, uint64_t head, bool& wasEqual);
+    void rebuildInnerNodes();
+    void unlinkLeaf(NodePtr leaf, PmseLatchSet& latches);
+    void latchSplit(NodePtr leaf, PmseLatchSet& latches);
+    void latchRemoval(NodePtr leaf, PmseLatchSet& latches);
+    void latchOrAnchor(NodePtr node, PmseLatchSet& latches) {
+        latches.lock(node != nullptr ? static_cast<const void*>(node.get()) : anchor());
+    }
+    bool removalStaysInLeaf(NodePtr leaf);
+
+    /* Slot holding index-th key of leaf */
+    uint64_t slotOf(NodePtr leaf, uint64_t index) const {
+        return _unsorted ? leaf->slotOrder[index] : index;
+    }
+    StringData leafSuffix(NodePtr leaf, uint64_t index) {
+        return leaf->keys[slotOf(leaf, index)].key();
+    }
+    StringData leafTypeBits(NodePtr leaf, uint64_t index) {
+        return leaf->keys[slotOf(leaf, index)].typeBits();
+    }
+    RecordId leafValue(NodePtr leaf, uint64_t index) {
+        return leaf->values_array[slotOf(leaf, index)];
+    }
+    uint64_t indexOfSlot(NodePtr leaf, uint64_t slot);
+    void insertSlot(NodePtr leaf, uint64_t index, StringData key, StringData typeBits,
+                    const RecordId& loc);
+    bool publishSlot(NodePtr leaf, StringData key, StringData typeBits, const RecordId& loc);
+    bool leafSlotsConsistent(NodePtr leaf);
+    void repairLeafSlots();
+    void removeSlot(NodePtr leaf, uint64_t index);
+    void compactLeaf(NodePtr leaf);
+    void resetLeafSlots(NodePtr leaf);
+    /* Index of first key of leaf not less than key, cmp is result of comparing them */
+    uint64_t leafLowerBound(NodePtr leaf, StringData key, int& cmp);
+
+    /* Encoded key at index of leaf, with prefix */
+    std::string leafKeyString(NodePtr leaf, uint64_t index);
+    PmseLeafComparator leafComparator(StringData key, NodePtr leaf);
+    int compareLeafKey(StringData key, NodePtr leaf, uint64_t index);
+    void setLeafKey(NodePtr leaf, uint64_t index, StringData key, StringData typeBits);
+    void fitLeafPrefix(NodePtr leaf, StringData key);
+    void rebuildLeafPrefix(NodePtr leaf);
+    void setLeafPrefix(NodePtr leaf, uint64_t size);
+    void retireLeafKeys(NodePtr leaf);
+    uint64_t findEqual(NodePtr leaf, uint64_t from, StringData key, uint8_t fingerprint);
+    bool equalAt(NodePtr leaf, uint64_t index, StringData key, uint8_t fingerprint);
+    bool duplicateIn(NodePtr leaf, StringData key, const RecordId& loc);
+    bool findEntry(StringData key, const RecordId& loc, CursorObject<ORDER>& found);
+    bool findEntryInLeaf(NodePtr leaf, StringData key, const RecordId& loc, uint64_t& index);
+
+    uint64_t prefaultSubtree(NodePtr node);
     uint64_t cut(uint64_t length);
-    void placeAfter(PMEMobjpool *pm_pool, BSONObj& key, const RecordId& loc);
-    void placeBefore(PMEMobjpool *pm_pool, BSONObj& key, const RecordId& loc);
-    int64_t getNeighborIndex(persistent_ptr<PmseTreeNode> node);
-    persistent_ptr<PmseTreeNode> coalesceNodes(
-                    pool_base pop, persistent_ptr<PmseTreeNode> root,
-                    persistent_ptr<PmseTreeNode> n,
-                    persistent_ptr<PmseTreeNode> neighbor,
-                    int64_t neighbor_index, BSONObj_PM k_prime);
-
-    persistent_ptr<PmseTreeNode> redistributeNodes(
-                    pool_base pop, persistent_ptr<PmseTreeNode> root,
-                    persistent_ptr<PmseTreeNode> n,
-                    persistent_ptr<PmseTreeNode> neighbor,
-                    int64_t neighbor_index, int64_t k_prime_index,
-                    BSONObj_PM k_prime);
-
-    persistent_ptr<PmseTreeNode> constructNewLeaf();
-    persistent_ptr<PmseTreeNode> makeTreeRoot(BSONObj_PM& key,
-                                              const RecordId& loc);
-    Status insertKeyIntoLeaf(persistent_ptr<PmseTreeNode> node, BSONObj_PM& key,
-                             const RecordId& loc, const BSONObj& _ordering);
-    /*persistent_ptr<PmseTreeNode> find(persistent_ptr<PmseTreeNode> node, BSONObj_PM& key,
-     const BSONObj& _ordering);*/
-    persistent_ptr<PmseTreeNode> locateLeafWithKey(
-                    persistent_ptr<PmseTreeNode> node, BSONObj& key,
-                    const BSONObj& _ordering);
-    persistent_ptr<PmseTreeNode> locateLeafWithKeyPM(
-                    persistent_ptr<PmseTreeNode> node, BSONObj_PM& key,
-                    const BSONObj& _ordering);
-    persistent_ptr<PmseTreeNode> splitFullNodeAndInsert(
-                    pool_base pop, persistent_ptr<PmseTreeNode> node,
-                    BSONObj_PM& key, const RecordId& loc,
-                    const BSONObj& _ordering);
-    persistent_ptr<PmseTreeNode> insertIntoNodeParent(
-                    pool_base pop, persistent_ptr<PmseTreeNode> root,
-                    persistent_ptr<PmseTreeNode> node, BSONObj_PM& new_key,
-                    persistent_ptr<PmseTreeNode> new_leaf);
-    persistent_ptr<PmseTreeNode> allocateNewRoot(
-                    pool_base pop, persistent_ptr<PmseTreeNode> left,
-                    BSONObj_PM& new_key, persistent_ptr<PmseTreeNode> right);
-    uint64_t getLeftIndex(persistent_ptr<PmseTreeNode> parent,
-                          persistent_ptr<PmseTreeNode> left);
-    persistent_ptr<PmseTreeNode> insertKeyIntoNode(
-                    pool_base pop, persistent_ptr<PmseTreeNode> root,
-                    persistent_ptr<PmseTreeNode> parent, uint64_t left_index,
-                    BSONObj_PM& new_key, persistent_ptr<PmseTreeNode> right);
-    persistent_ptr<PmseTreeNode> insertToNodeAfterSplit(
-                    pool_base pop, persistent_ptr<PmseTreeNode> root,
-                    persistent_ptr<PmseTreeNode> old_node, uint64_t left_index,
-                    BSONObj_PM& new_key, persistent_ptr<PmseTreeNode> right);
-    persistent_ptr<PmseTreeNode> adjustRoot(persistent_ptr<PmseTreeNode> root);
-    persistent_ptr<PmseTreeNode> deleteEntry(pool_base pop, BSONObj& key,
-                                             persistent_ptr<PmseTreeNode> node,
-                                             uint64_t index);
-
-    persistent_ptr<PmseTreeNode> removeEntryFromNode(
-                    BSONObj& key, persistent_ptr<PmseTreeNode> node,
-                    uint64_t index);
-
-    persistent_ptr<PmseTreeNode> current;
-    persistent_ptr<PmseTreeNode> root;
-    persistent_ptr<PmseTreeNode> first;
-    persistent_ptr<PmseTreeNode> last;
-    CursorObject _cursor;
-    BSONObj _ordering;
-    p<bool> modified = false;
+    int64_t getNeighborIndex(NodePtr node);
+    NodePtr coalesceNodes(NodePtr root, NodePtr n, NodePtr neighbor,
+                          int64_t neighbor_index, PmseKey k_prime);
+    NodePtr redistributeNodes(NodePtr root, NodePtr n, NodePtr neighbor,
+                              int64_t neighbor_index, int64_t k_prime_index,
+                              PmseKey k_prime);
+    NodePtr makeTreeRoot(StringData key, StringData typeBits, const RecordId& loc);
+    Status insertKeyIntoLeaf(NodePtr node, StringData key, StringData typeBits,
+                             const RecordId& loc);
+    NodePtr splitFullNodeAndInsert(NodePtr node, StringData key, StringData typeBits,
+                                   const RecordId& loc, PmseLatchSet& latches);
+    NodePtr insertIntoNodeParent(NodePtr root, NodePtr node, StringData new_key,
+                                 NodePtr new_leaf);
+    NodePtr allocateNewRoot(NodePtr left, PmseKey& new_key, NodePtr right);
+    uint64_t getLeftIndex(NodePtr parent, NodePtr left);
+    NodePtr insertKeyIntoNode(NodePtr root, NodePtr parent, uint64_t left_index,
+                              PmseKey& new_key, NodePtr right);
+    NodePtr insertToNodeAfterSplit(NodePtr root, NodePtr old_node, uint64_t left_index,
+                                   PmseKey& new_key, NodePtr right);
+    NodePtr adjustRoot(NodePtr root);
+    NodePtr deleteEntry(NodePtr node, uint64_t index);
+    NodePtr removeEntryFromNode(NodePtr node, uint64_t index);
+
+    pool_base _pop;
+    persistent_ptr<PmseTree> _tree;
+    const Ordering _keyOrdering;
+    bool _unsorted;
+    bool _volatileInner;
+    PmseInnerIndex<ORDER> _inner;
+    /* Readers search _inner in place, structure changes modify it exclusively */
+    PmseSharedLatch _innerLatch;
+    PmseLatchTable _latches;
+    /* Serializes structure changes, leaf-only writes run beside them */
+    stdx::mutex _structureMutex;
 };
 
 }